@@ -0,0 +1,372 @@
+// Benchmark of layers from real networks, run with each predefined loop nest.
+// Built and run on the host by `make bench`. Results are printed as CSV, one
+// line per layer and loop nest:
+//
+//   network,layer,op,nest,cycles,macs,macs_per_cycle,bytes,speedup_vs_naive
+//
+// `cycles` is the host's cycle/tick counter (time stamp counter on x86,
+// virtual counter on AArch64, nanoseconds elsewhere), taking the fastest of
+// the repeats. `bytes` is the memory traffic estimated by the tuning model
+// (see `lat_loop_nest_traffic`), or the tensor sizes for pooling. Pooling has
+// no loop nest; its `macs` column counts window elements visited.
+//
+// Options:
+//   -s N   Divide all image sizes by N, for quicker runs (default 1)
+//   -r N   Run each configuration N times (default 3)
+//   -n S   Only run layers from networks whose name contains S
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "nn/layers.h"
+#include "nn/loops.h"
+#include "nn/tuning.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+enum LayerKind {
+  KIND_CONV,
+  KIND_LINEAR,
+  KIND_MAX_POOL,
+  KIND_AVG_POOL
+};
+
+typedef struct {
+  const char*    network;
+  const char*    name;
+  enum LayerKind kind;
+
+  // For convolution/pooling: batch, channels in/out, image size (square),
+  // filter/window size, stride, padding, groups. For linear layers: batch,
+  // inputs, outputs.
+  uint32_t batch;
+  uint32_t in;
+  uint32_t out;
+  uint32_t size;
+  uint32_t filter;
+  uint32_t stride;
+  uint32_t padding;
+  uint32_t groups;
+} layer_t;
+
+static const layer_t catalogue[] = {
+  // ResNet-50 (batch 1, 224x224 input).
+  {"resnet50", "conv1",        KIND_CONV,     1,    3,   64, 224, 7, 2, 3,  1},
+  {"resnet50", "pool1",        KIND_MAX_POOL, 1,   64,   64, 112, 3, 2, 0,  1},
+  {"resnet50", "res2_1x1a",    KIND_CONV,     1,   64,   64,  56, 1, 1, 0,  1},
+  {"resnet50", "res2_3x3",     KIND_CONV,     1,   64,   64,  56, 3, 1, 1,  1},
+  {"resnet50", "res2_1x1b",    KIND_CONV,     1,   64,  256,  56, 1, 1, 0,  1},
+  {"resnet50", "res3_3x3",     KIND_CONV,     1,  128,  128,  28, 3, 1, 1,  1},
+  {"resnet50", "res4_3x3",     KIND_CONV,     1,  256,  256,  14, 3, 1, 1,  1},
+  {"resnet50", "res5_3x3",     KIND_CONV,     1,  512,  512,   7, 3, 1, 1,  1},
+  {"resnet50", "res5_1x1",     KIND_CONV,     1, 2048,  512,   7, 1, 1, 0,  1},
+  {"resnet50", "avgpool",      KIND_AVG_POOL, 1, 2048, 2048,   7, 7, 1, 0,  1},
+  {"resnet50", "fc",           KIND_LINEAR,   1, 2048, 1000},
+
+  // VGG-16 (batch 1, 224x224 input).
+  {"vgg16",    "conv1_1",      KIND_CONV,     1,    3,   64, 224, 3, 1, 1,  1},
+  {"vgg16",    "conv1_2",      KIND_CONV,     1,   64,   64, 224, 3, 1, 1,  1},
+  {"vgg16",    "pool1",        KIND_MAX_POOL, 1,   64,   64, 224, 2, 2, 0,  1},
+  {"vgg16",    "conv3_1",      KIND_CONV,     1,  128,  256,  56, 3, 1, 1,  1},
+  {"vgg16",    "conv5_1",      KIND_CONV,     1,  512,  512,  14, 3, 1, 1,  1},
+  {"vgg16",    "fc6",          KIND_LINEAR,   1, 25088, 4096},
+  {"vgg16",    "fc7",          KIND_LINEAR,   1, 4096, 4096},
+
+  // MobileNetV2 (batch 1, 224x224 input).
+  {"mobilenetv2", "conv1",     KIND_CONV,     1,    3,   32, 224, 3, 2, 1,  1},
+  {"mobilenetv2", "dw1",       KIND_CONV,     1,   32,   32, 112, 3, 1, 1, 32},
+  {"mobilenetv2", "pw1",       KIND_CONV,     1,   32,   16, 112, 1, 1, 0,  1},
+  {"mobilenetv2", "expand2",   KIND_CONV,     1,   16,   96, 112, 1, 1, 0,  1},
+  {"mobilenetv2", "dw2",       KIND_CONV,     1,   96,   96, 112, 3, 2, 1, 96},
+  {"mobilenetv2", "dw4",       KIND_CONV,     1,  192,  192,  28, 3, 1, 1, 192},
+  {"mobilenetv2", "conv_last", KIND_CONV,     1,  320, 1280,   7, 1, 1, 0,  1},
+  {"mobilenetv2", "avgpool",   KIND_AVG_POOL, 1, 1280, 1280,   7, 7, 1, 0,  1},
+
+  // BERT-base encoder linear layers (128 tokens).
+  {"bert",     "qkv",          KIND_LINEAR, 128,  768, 2304},
+  {"bert",     "attn_out",     KIND_LINEAR, 128,  768,  768},
+  {"bert",     "ffn_up",       KIND_LINEAR, 128,  768, 3072},
+  {"bert",     "ffn_down",     KIND_LINEAR, 128, 3072,  768},
+};
+#define NUM_LAYERS (sizeof(catalogue) / sizeof(layer_t))
+
+typedef struct {
+  const char*        name;
+  const loop_nest_t* nest;  // NULL for automatic choice
+} nest_option_t;
+
+static const nest_option_t nests[] = {
+  {"naive",             &LOOP_NEST_NAIVE},
+  {"output_stationary", &LOOP_NEST_OUTPUT_STATIONARY},
+  {"input_stationary",  &LOOP_NEST_INPUT_STATIONARY},
+  {"weight_stationary", &LOOP_NEST_WEIGHT_STATIONARY},
+  {"auto",              NULL},
+};
+#define NUM_NESTS (sizeof(nests) / sizeof(nest_option_t))
+
+static uint64_t read_cycles(void) {
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#elif defined(__aarch64__)
+  uint64_t ticks;
+  __asm__ volatile("mrs %0, cntvct_el0" : "=r"(ticks));
+  return ticks;
+#else
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+#endif
+}
+
+static data_t* allocate_data(size_t words) {
+  data_t* data = malloc(words * sizeof(data_t));
+  if (data == NULL) {
+    fprintf(stderr, "Error: out of memory\n");
+    exit(1);
+  }
+
+  for (size_t i=0; i<words; i++)
+    data[i] = (rand() % 7) - 3;
+
+  return data;
+}
+
+static activation_config_t make_activations(data_t* data, uint32_t batch,
+                                            uint32_t channels, uint32_t height,
+                                            uint32_t width) {
+  activation_config_t tensor;
+  tensor.data.address = data;
+  tensor.data.memory_config = 0;
+  tensor.column_stride = sizeof(data_t);
+  tensor.row_stride = width * tensor.column_stride;
+  tensor.channel_stride = height * tensor.row_stride;
+  tensor.batch_stride = channels * tensor.channel_stride;
+  return tensor;
+}
+
+// Image size after scaling, keeping at least one full window.
+static uint32_t scaled(uint32_t size, uint32_t divisor, uint32_t window) {
+  size /= divisor;
+  return (size < window) ? window : size;
+}
+
+static void print_result(const layer_t* layer, const char* op,
+                         const char* nest, uint64_t cycles, uint64_t macs,
+                         uint64_t bytes, uint64_t naive_cycles) {
+  printf("%s,%s,%s,%s,%llu,%llu,%.4f,%llu,", layer->network, layer->name, op,
+         nest, (unsigned long long)cycles, (unsigned long long)macs,
+         (cycles == 0) ? 0.0 : (double)macs / cycles,
+         (unsigned long long)bytes);
+
+  if (naive_cycles > 0 && cycles > 0)
+    printf("%.3f\n", (double)naive_cycles / cycles);
+  else
+    printf("\n");
+}
+
+static void bench_conv(const layer_t* layer, uint32_t divisor,
+                       uint32_t repeats) {
+  conv_shape_t shape;
+  if (layer->kind == KIND_LINEAR) {
+    memset(&shape, 0, sizeof(shape));
+    shape.batch_size = layer->batch;
+    shape.in_channels = layer->in;
+    shape.out_channels = layer->out;
+    shape.image_width = shape.image_height = 1;
+    shape.filter_width = shape.filter_height = 1;
+    shape.groups = shape.stride = shape.dilation = 1;
+  }
+  else {
+    shape.batch_size = layer->batch;
+    shape.in_channels = layer->in;
+    shape.out_channels = layer->out;
+    shape.image_height = scaled(layer->size, divisor, layer->filter);
+    shape.image_width = shape.image_height;
+    shape.filter_width = shape.filter_height = layer->filter;
+    shape.groups = layer->groups;
+    shape.stride = layer->stride;
+    shape.dilation = 1;
+    shape.padding_h = shape.padding_w = layer->padding;
+  }
+
+  uint32_t out_h = (shape.image_height + 2 * shape.padding_h -
+                    shape.filter_height) / shape.stride + 1;
+  uint32_t out_w = (shape.image_width + 2 * shape.padding_w -
+                    shape.filter_width) / shape.stride + 1;
+  uint32_t in_per_group = shape.in_channels / shape.groups;
+  uint32_t filter_size = shape.filter_height * shape.filter_width;
+
+  data_t* in_data = allocate_data((size_t)shape.batch_size * shape.in_channels *
+                                  shape.image_height * shape.image_width);
+  data_t* weight_data = allocate_data((size_t)shape.out_channels *
+                                      in_per_group * filter_size);
+
+  // Input stationary writes outputs up to (filter size - 1) positions before
+  // the start of the buffer, so leave a margin.
+  size_t margin = (size_t)(shape.filter_height - 1) * out_w +
+                  (shape.filter_width - 1);
+  size_t out_words = (size_t)shape.batch_size * shape.out_channels * out_h *
+                     out_w;
+  data_t* out_data = allocate_data(out_words + margin);
+
+  activation_config_t input = make_activations(in_data, shape.batch_size,
+      shape.in_channels, shape.image_height, shape.image_width);
+  activation_config_t output = make_activations(out_data + margin,
+      shape.batch_size, shape.out_channels, out_h, out_w);
+
+  filter_config_t weights;
+  weights.data.address = weight_data;
+  weights.data.memory_config = 0;
+  weights.column_stride = sizeof(data_t);
+  weights.row_stride = shape.filter_width * weights.column_stride;
+  weights.in_channel_stride = shape.filter_height * weights.row_stride;
+  weights.out_channel_stride = in_per_group * weights.in_channel_stride;
+  weights.group_stride =
+      (shape.out_channels / shape.groups) * weights.out_channel_stride;
+
+  uint64_t macs = (uint64_t)shape.batch_size * shape.out_channels * out_h *
+                  out_w * in_per_group * filter_size;
+  const char* op = (layer->kind == KIND_LINEAR) ? "linear" : "conv2d";
+  uint64_t naive_cycles = 0;
+
+  for (uint n=0; n<NUM_NESTS; n++) {
+    const loop_nest_t* nest = nests[n].nest;
+
+    // Input stationary can't handle padding.
+    if (nest == &LOOP_NEST_INPUT_STATIONARY &&
+        (shape.padding_h > 0 || shape.padding_w > 0))
+      continue;
+
+    uint64_t best = UINT64_MAX;
+    for (uint r=0; r<repeats; r++) {
+      uint64_t start = read_cycles();
+      if (layer->kind == KIND_LINEAR)
+        lat_linear(&input, &weights, &output, shape.batch_size,
+                   shape.in_channels, shape.out_channels, nest);
+      else
+        lat_conv2d(&input, &weights, &output, &shape, nest);
+      uint64_t cycles = read_cycles() - start;
+
+      if (cycles < best)
+        best = cycles;
+    }
+
+    if (nest == &LOOP_NEST_NAIVE)
+      naive_cycles = best;
+
+    const loop_nest_t* used = (nest == NULL) ? lat_choose_loop_nest(&shape)
+                                             : nest;
+    print_result(layer, op, nests[n].name, best, macs,
+                 lat_loop_nest_traffic(&shape, used), naive_cycles);
+  }
+
+  free(in_data);
+  free(weight_data);
+  free(out_data);
+}
+
+static void bench_pool(const layer_t* layer, uint32_t divisor,
+                       uint32_t repeats) {
+  pool_shape_t shape;
+  shape.batch_size = layer->batch;
+  shape.channels = layer->in;
+  shape.input_height = scaled(layer->size, divisor, layer->filter);
+  shape.input_width = shape.input_height;
+  shape.window_width = shape.window_height = layer->filter;
+  shape.stride = layer->stride;
+
+  // Global pooling stays global when images are scaled down.
+  if (shape.window_width > shape.input_width)
+    shape.window_width = shape.window_height = shape.input_width;
+
+  uint32_t out_h = (shape.input_height - shape.window_height) / shape.stride
+                   + 1;
+  uint32_t out_w = (shape.input_width - shape.window_width) / shape.stride + 1;
+  size_t in_words = (size_t)shape.batch_size * shape.channels *
+                    shape.input_height * shape.input_width;
+  size_t out_words = (size_t)shape.batch_size * shape.channels * out_h * out_w;
+
+  data_t* in_data = allocate_data(in_words);
+  data_t* out_data = allocate_data(out_words);
+  activation_config_t input = make_activations(in_data, shape.batch_size,
+      shape.channels, shape.input_height, shape.input_width);
+  activation_config_t output = make_activations(out_data, shape.batch_size,
+      shape.channels, out_h, out_w);
+
+  uint64_t best = UINT64_MAX;
+  for (uint r=0; r<repeats; r++) {
+    uint64_t start = read_cycles();
+    if (layer->kind == KIND_MAX_POOL)
+      lat_max_pool_2d(&input, &output, &shape);
+    else
+      lat_avg_pool_2d(&input, &output, &shape);
+    uint64_t cycles = read_cycles() - start;
+
+    if (cycles < best)
+      best = cycles;
+  }
+
+  uint64_t ops = (uint64_t)out_words * shape.window_width *
+                 shape.window_height;
+  print_result(layer, (layer->kind == KIND_MAX_POOL) ? "max_pool_2d"
+                                                     : "avg_pool_2d",
+               "-", best, ops, (in_words + out_words) * sizeof(data_t), 0);
+
+  free(in_data);
+  free(out_data);
+}
+
+int main(int argc, char** argv) {
+  uint32_t divisor = 1;
+  uint32_t repeats = 3;
+  const char* network = NULL;
+
+  int option;
+  while ((option = getopt(argc, argv, "s:r:n:")) != -1) {
+    switch (option) {
+      case 's':
+        divisor = atoi(optarg);
+        break;
+      case 'r':
+        repeats = atoi(optarg);
+        break;
+      case 'n':
+        network = optarg;
+        break;
+      default:
+        fprintf(stderr, "Usage: %s [-s divisor] [-r repeats] [-n network]\n",
+                argv[0]);
+        return 1;
+    }
+  }
+
+  if (divisor == 0 || repeats == 0) {
+    fprintf(stderr, "Error: -s and -r must be positive\n");
+    return 1;
+  }
+
+  lat_set_warnings(0);
+  srand(0);
+
+  printf("network,layer,op,nest,cycles,macs,macs_per_cycle,bytes,"
+         "speedup_vs_naive\n");
+
+  for (uint i=0; i<NUM_LAYERS; i++) {
+    const layer_t* layer = &catalogue[i];
+    if (network != NULL && strstr(layer->network, network) == NULL)
+      continue;
+
+    if (layer->kind == KIND_CONV || layer->kind == KIND_LINEAR)
+      bench_conv(layer, divisor, repeats);
+    else
+      bench_pool(layer, divisor, repeats);
+
+    fflush(stdout);
+  }
+
+  return 0;
+}
@@ -0,0 +1,18 @@
+// Host replacement for lat-ifc's accelerator interface. Computation is
+// performed in software by `host/src/run.c`.
+
+#ifndef LAT_NN_HOST_LAT_RUN_H
+#define LAT_NN_HOST_LAT_RUN_H
+
+#include <assert.h>
+#include <sys/types.h>
+#include <lat/types.h>
+
+// Execute the whole loop nest described by `params`. Computation completes
+// before this function returns.
+void lat_accelerate(const lat_parameters_t* params);
+
+// Wait for the computation described by `params` to finish. No-op on the host.
+void lat_sync(const lat_parameters_t* params);
+
+#endif // include guard
@@ -0,0 +1,17 @@
+// Host replacement for libloki's allocator. There is only one address space
+// on the host, so this maps directly onto the C library.
+
+#ifndef LAT_NN_HOST_LOKI_ALLOC_H
+#define LAT_NN_HOST_LOKI_ALLOC_H
+
+#include <stdlib.h>
+
+static inline void* loki_malloc(size_t size) {
+  return malloc(size);
+}
+
+static inline void loki_free(void* ptr) {
+  free(ptr);
+}
+
+#endif // include guard
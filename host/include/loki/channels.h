@@ -0,0 +1,34 @@
+// Host replacement for libloki's channel configuration. Channels don't exist
+// on the host, so addresses are opaque values and configuration is a no-op.
+
+#ifndef LAT_NN_HOST_LOKI_CHANNELS_H
+#define LAT_NN_HOST_LOKI_CHANNELS_H
+
+#include <stdint.h>
+#include <lat/types.h>
+
+enum {
+  CH_REGISTER_2 = 2,
+  CH_REGISTER_3 = 3,
+  CH_REGISTER_4 = 4,
+  CH_REGISTER_5 = 5,
+  CH_REGISTER_6 = 6,
+  CH_REGISTER_7 = 7
+};
+
+static inline uint32_t single_core_bitmask(uint core) {
+  return 1u << core;
+}
+
+static inline channel_t loki_mcast_address(uint32_t bitmask, int channel,
+                                           int acknowledge) {
+  (void)acknowledge;
+  return (bitmask << 8) | channel;
+}
+
+static inline void set_channel_map(int output, int address) {
+  (void)output;
+  (void)address;
+}
+
+#endif // include guard
@@ -0,0 +1,27 @@
+// Host replacement for libloki's control registers. Only the cycle counter is
+// provided, using the host's timestamp counter.
+
+#ifndef LAT_NN_HOST_LOKI_CONTROL_REGISTERS_H
+#define LAT_NN_HOST_LOKI_CONTROL_REGISTERS_H
+
+#include <stdint.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+static inline uint64_t get_cycle_count(void) {
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#elif defined(__aarch64__)
+  uint64_t ticks;
+  __asm__ volatile("mrs %0, cntvct_el0" : "=r"(ticks));
+  return ticks;
+#else
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+#endif
+}
+
+#endif // include guard
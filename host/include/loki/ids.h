@@ -0,0 +1,28 @@
+// Host replacement for libloki's core/tile identifiers. The host runs one
+// simulated core at a time; `loki_execute` (host/src/loki.c) sets which one.
+
+#ifndef LAT_NN_HOST_LOKI_IDS_H
+#define LAT_NN_HOST_LOKI_IDS_H
+
+#include <assert.h>
+#include <sys/types.h>
+
+// Matches the Loki configuration assumed by this library.
+#define CORES_PER_TILE 2
+
+// Position of the currently-executing core among all cores.
+extern uint loki_host_unique_core_id;
+
+static inline uint get_unique_core_id(void) {
+  return loki_host_unique_core_id;
+}
+
+static inline uint get_core_id(void) {
+  return loki_host_unique_core_id % CORES_PER_TILE;
+}
+
+static inline uint get_tile_id(void) {
+  return loki_host_unique_core_id / CORES_PER_TILE;
+}
+
+#endif // include guard
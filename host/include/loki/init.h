@@ -0,0 +1,22 @@
+// Host replacement for libloki's multi-core execution.
+
+#ifndef LAT_NN_HOST_LOKI_INIT_H
+#define LAT_NN_HOST_LOKI_INIT_H
+
+#include <stddef.h>
+
+typedef void (*distributable_func)(const void* data);
+
+// A function to be executed on many cores.
+typedef struct {
+  int                cores;      // Number of cores to run on
+  distributable_func func;       // Function to execute
+  const void*        data;       // Argument passed to the function
+  size_t             data_size;  // Size of argument
+} distributed_func;
+
+// Execute a function on many cores and wait for them all to finish. On the
+// host, each core runs in turn.
+void loki_execute(const distributed_func* config);
+
+#endif // include guard
@@ -0,0 +1,17 @@
+// Host implementations of libloki functions which need state.
+
+#include <loki/ids.h>
+#include <loki/init.h>
+
+uint loki_host_unique_core_id = 0;
+
+void loki_execute(const distributed_func* config) {
+  uint caller = loki_host_unique_core_id;
+
+  for (int core=0; core<config->cores; core++) {
+    loki_host_unique_core_id = core;
+    config->func(config->data);
+  }
+
+  loki_host_unique_core_id = caller;
+}
@@ -0,0 +1,299 @@
+// Software model of the Loki accelerator template, for running the library on
+// a host machine. Every point in the loop nest described by a
+// `lat_parameters_t` performs `out += in1 * in2`, with all three addresses
+// computed from the base addresses and the (byte) strides of each loop.
+//
+// Most of the time is spent in the innermost loop, so there are specialised
+// kernels for the stride patterns which the standard loop nests produce:
+//  * Reduction (output stride 0), e.g. IN_CHANNELS innermost in
+//    LOOP_NEST_OUTPUT_STATIONARY
+//  * Broadcast of one operand (input stride 0), e.g. IMAGE_WIDTH/IMAGE_HEIGHT
+//    innermost in LOOP_NEST_WEIGHT_STATIONARY
+// Each has a SIMD version for unit-stride data and a scalar version for
+// everything else.
+
+#include <string.h>
+#include <lat/run.h>
+
+// Use the compiler's generic vector extension rather than intrinsics so the
+// same code works with gcc and clang on any host architecture.
+typedef data_t vector_t __attribute__((vector_size(16)));
+#define VECTOR_LENGTH (sizeof(vector_t) / sizeof(data_t))
+
+// Perform `count` iterations of the innermost loop. Strides are in bytes.
+typedef void (*kernel_t)(const char* in1, int32_t in1_stride,
+                         const char* in2, int32_t in2_stride,
+                         char* out, int32_t out_stride,
+                         uint32_t count);
+
+static inline vector_t load_vector(const char* address) {
+  vector_t v;
+  memcpy(&v, address, sizeof(v));
+  return v;
+}
+
+static inline void store_vector(char* address, vector_t v) {
+  memcpy(address, &v, sizeof(v));
+}
+
+static inline data_t load(const char* address) {
+  return *(const data_t*)address;
+}
+
+static inline void accumulate(char* address, data_t value) {
+  *(data_t*)address += value;
+}
+
+// out += sum(in1[i] * in2[i]), with unit-stride inputs.
+static void reduce_contiguous(const char* in1, int32_t in1_stride,
+                              const char* in2, int32_t in2_stride,
+                              char* out, int32_t out_stride,
+                              uint32_t count) {
+  vector_t sum = {0};
+  uint32_t i = 0;
+
+  for (; i + VECTOR_LENGTH <= count; i += VECTOR_LENGTH) {
+    sum += load_vector(in1) * load_vector(in2);
+    in1 += sizeof(vector_t);
+    in2 += sizeof(vector_t);
+  }
+
+  data_t total = 0;
+  for (uint32_t lane=0; lane<VECTOR_LENGTH; lane++)
+    total += sum[lane];
+
+  for (; i<count; i++) {
+    total += load(in1) * load(in2);
+    in1 += sizeof(data_t);
+    in2 += sizeof(data_t);
+  }
+
+  accumulate(out, total);
+}
+
+// out += sum(in1[i] * in2[i]), with arbitrary input strides. Multiple partial
+// sums break the dependency chain between iterations.
+static void reduce_strided(const char* in1, int32_t in1_stride,
+                           const char* in2, int32_t in2_stride,
+                           char* out, int32_t out_stride,
+                           uint32_t count) {
+  data_t sum0 = 0, sum1 = 0, sum2 = 0, sum3 = 0;
+  uint32_t i = 0;
+
+  for (; i + 4 <= count; i += 4) {
+    sum0 += load(in1)                  * load(in2);
+    sum1 += load(in1 + in1_stride)     * load(in2 + in2_stride);
+    sum2 += load(in1 + 2 * in1_stride) * load(in2 + 2 * in2_stride);
+    sum3 += load(in1 + 3 * in1_stride) * load(in2 + 3 * in2_stride);
+    in1 += 4 * in1_stride;
+    in2 += 4 * in2_stride;
+  }
+
+  for (; i<count; i++) {
+    sum0 += load(in1) * load(in2);
+    in1 += in1_stride;
+    in2 += in2_stride;
+  }
+
+  accumulate(out, sum0 + sum1 + sum2 + sum3);
+}
+
+// out[i] += in1[i] * in2, with unit-stride in1 and out.
+static void broadcast_contiguous(const char* in1, int32_t in1_stride,
+                                 const char* in2, int32_t in2_stride,
+                                 char* out, int32_t out_stride,
+                                 uint32_t count) {
+  data_t scalar = load(in2);
+  vector_t weight = scalar - (vector_t){0};
+  uint32_t i = 0;
+
+  for (; i + VECTOR_LENGTH <= count; i += VECTOR_LENGTH) {
+    store_vector(out, load_vector(out) + load_vector(in1) * weight);
+    in1 += sizeof(vector_t);
+    out += sizeof(vector_t);
+  }
+
+  for (; i<count; i++) {
+    accumulate(out, load(in1) * scalar);
+    in1 += sizeof(data_t);
+    out += sizeof(data_t);
+  }
+}
+
+// out[i] += in1[i] * in2, with arbitrary strides.
+static void broadcast_strided(const char* in1, int32_t in1_stride,
+                              const char* in2, int32_t in2_stride,
+                              char* out, int32_t out_stride,
+                              uint32_t count) {
+  data_t scalar = load(in2);
+
+  for (uint32_t i=0; i<count; i++) {
+    accumulate(out, load(in1) * scalar);
+    in1 += in1_stride;
+    out += out_stride;
+  }
+}
+
+// out[i] += in1[i] * in2[i], with all operands unit-stride.
+static void elementwise_contiguous(const char* in1, int32_t in1_stride,
+                                   const char* in2, int32_t in2_stride,
+                                   char* out, int32_t out_stride,
+                                   uint32_t count) {
+  uint32_t i = 0;
+
+  for (; i + VECTOR_LENGTH <= count; i += VECTOR_LENGTH) {
+    store_vector(out, load_vector(out) + load_vector(in1) * load_vector(in2));
+    in1 += sizeof(vector_t);
+    in2 += sizeof(vector_t);
+    out += sizeof(vector_t);
+  }
+
+  for (; i<count; i++) {
+    accumulate(out, load(in1) * load(in2));
+    in1 += sizeof(data_t);
+    in2 += sizeof(data_t);
+    out += sizeof(data_t);
+  }
+}
+
+// Fallback for any combination of strides.
+static void generic(const char* in1, int32_t in1_stride,
+                    const char* in2, int32_t in2_stride,
+                    char* out, int32_t out_stride,
+                    uint32_t count) {
+  for (uint32_t i=0; i<count; i++) {
+    accumulate(out, load(in1) * load(in2));
+    in1 += in1_stride;
+    in2 += in2_stride;
+    out += out_stride;
+  }
+}
+
+static int is_unit(int32_t stride) {
+  return stride == sizeof(data_t);
+}
+
+// Choose a kernel for the given loop. Assumes that if only one input is
+// broadcast, it is `in2` (see `lat_accelerate`).
+static kernel_t select_kernel(const loop_iteration_t* loop) {
+  if (loop->out_stride == 0) {
+    if (is_unit(loop->in1_stride) && is_unit(loop->in2_stride))
+      return reduce_contiguous;
+    else
+      return reduce_strided;
+  }
+  else if (loop->in2_stride == 0) {
+    if (is_unit(loop->in1_stride) && is_unit(loop->out_stride))
+      return broadcast_contiguous;
+    else
+      return broadcast_strided;
+  }
+  else if (is_unit(loop->in1_stride) && is_unit(loop->in2_stride) &&
+           is_unit(loop->out_stride)) {
+    return elementwise_contiguous;
+  }
+  else
+    return generic;
+}
+
+// Whether the loop can use one of the SIMD kernels.
+static int is_vectorisable(const loop_iteration_t* loop, uint32_t count) {
+  if (count < VECTOR_LENGTH)
+    return 0;
+
+  kernel_t kernel = select_kernel(loop);
+  return kernel == reduce_contiguous || kernel == broadcast_contiguous ||
+         kernel == elementwise_contiguous;
+}
+
+void lat_accelerate(const lat_parameters_t* params) {
+  const uint32_t loop_count = params->loop_count;
+
+  const char* in1 = (const char*)params->in1.address;
+  const char* in2 = (const char*)params->in2.address;
+  char* out = (char*)params->out.address;
+
+  if (loop_count == 0) {
+    accumulate(out, load(in1) * load(in2));
+    return;
+  }
+
+  for (uint i=0; i<loop_count; i++)
+    if (params->iteration_counts[i] == 0)
+      return;
+
+  loop_iteration_t loops[loop_count];
+  uint32_t counts[loop_count];
+  uint32_t index[loop_count];
+
+  memcpy(loops, params->loops, loop_count * sizeof(loop_iteration_t));
+  memcpy(counts, params->iteration_counts, loop_count * sizeof(uint32_t));
+  memset(index, 0, sizeof(index));
+
+  // Every point of the iteration space is independent (accumulation order
+  // aside), so loops may be interchanged freely. If the innermost loop can't
+  // be vectorised but another can, move the longest such loop innermost.
+  uint inner = loop_count - 1;
+  if (!is_vectorisable(&loops[inner], counts[inner])) {
+    for (uint i=0; i<loop_count; i++) {
+      if (is_vectorisable(&loops[i], counts[i]) &&
+          (inner == loop_count - 1 || counts[i] > counts[inner]))
+        inner = i;
+    }
+  }
+  if (inner != loop_count - 1) {
+    loop_iteration_t loop = loops[inner];
+    uint32_t count = counts[inner];
+    loops[inner] = loops[loop_count - 1];
+    counts[inner] = counts[loop_count - 1];
+    loops[loop_count - 1] = loop;
+    counts[loop_count - 1] = count;
+  }
+
+  // Kernels expect any single broadcast operand to be `in2`. Multiplication
+  // is commutative, so swap the inputs if necessary.
+  loop_iteration_t* innermost = &loops[loop_count - 1];
+  if (innermost->in1_stride == 0 && innermost->in2_stride != 0) {
+    const char* temp = in1;
+    in1 = in2;
+    in2 = temp;
+
+    for (uint i=0; i<loop_count; i++) {
+      int32_t stride = loops[i].in1_stride;
+      loops[i].in1_stride = loops[i].in2_stride;
+      loops[i].in2_stride = stride;
+    }
+  }
+
+  kernel_t kernel = select_kernel(innermost);
+  const uint32_t inner_count = counts[loop_count - 1];
+
+  while (1) {
+    kernel(in1, innermost->in1_stride, in2, innermost->in2_stride,
+           out, innermost->out_stride, inner_count);
+
+    // Step through the outer loops, innermost first.
+    int loop = loop_count - 2;
+    for (; loop >= 0; loop--) {
+      in1 += loops[loop].in1_stride;
+      in2 += loops[loop].in2_stride;
+      out += loops[loop].out_stride;
+
+      if (++index[loop] < counts[loop])
+        break;
+
+      in1 -= (ptrdiff_t)loops[loop].in1_stride * counts[loop];
+      in2 -= (ptrdiff_t)loops[loop].in2_stride * counts[loop];
+      out -= (ptrdiff_t)loops[loop].out_stride * counts[loop];
+      index[loop] = 0;
+    }
+
+    if (loop < 0)
+      break;
+  }
+}
+
+void lat_sync(const lat_parameters_t* params) {
+  // Computation completed inside `lat_accelerate`.
+  (void)params;
+}
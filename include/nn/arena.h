@@ -0,0 +1,52 @@
+#ifndef LAT_NN_ARENA_H
+#define LAT_NN_ARENA_H
+
+#include <stddef.h>
+#include <lat/types.h>
+
+// Allocations are aligned to this many bytes (one cache line), so tensors
+// used by different tiles never share a line.
+#ifndef LAT_ARENA_ALIGNMENT
+#define LAT_ARENA_ALIGNMENT 32
+#endif
+
+// A region of memory from which tensors are allocated by bumping a pointer.
+// Individual allocations are never freed: the whole arena is reset at once,
+// e.g. between inferences.
+//
+// Allocation is safe from any core on any tile, since the only shared state is
+// updated atomically. Creation, reset and destruction must not happen while
+// other cores are allocating.
+typedef struct {
+  char*  base;
+  size_t size;
+  size_t used;
+
+  // Memory group used for tensors allocated from this arena.
+  int    memory_config;
+
+  // Whether `base` was allocated by `lat_arena_create`.
+  int    owns_memory;
+} lat_arena_t;
+
+// Allocate an arena of `size` bytes using `loki_malloc`. Returns NULL if there
+// is not enough memory.
+lat_arena_t* lat_arena_create(size_t size, int memory_config);
+
+// Set up an arena in memory provided by the caller (e.g. a static array).
+void lat_arena_init(lat_arena_t* arena, void* memory, size_t size,
+                    int memory_config);
+
+// Free an arena and everything allocated from it.
+void lat_arena_destroy(lat_arena_t* arena);
+
+// Free everything allocated from the arena, in constant time.
+void lat_arena_reset(lat_arena_t* arena);
+
+// Allocate `size` bytes. Returns NULL if the arena is full.
+void* lat_arena_alloc(lat_arena_t* arena, size_t size);
+
+// Number of bytes currently allocated (including alignment padding).
+size_t lat_arena_used(const lat_arena_t* arena);
+
+#endif // include guard
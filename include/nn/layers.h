@@ -2,6 +2,7 @@
 #define LAT_NN_LAYERS_H
 
 #include <lat/types.h>
+#include "arena.h"
 #include "loops.h"
 #include "tensor.h"
 
@@ -16,6 +17,8 @@ typedef struct {
   uint32_t filter_height;
 
   // Channels (both in and out) partitioned into this many groups: default 1.
+  // Each group's weights are `group_stride` bytes apart. Depthwise convolution
+  // has groups == in_channels.
   uint32_t groups;
 
   // Step size (in pixels) between adjacent filter positions: default 1.
@@ -23,6 +26,11 @@ typedef struct {
 
   // Distance between activation pixels multiplied by weights: default 1.
   uint32_t dilation;
+
+  // Implicit zero padding (in pixels) added to each side of the input: default
+  // 0. Padding is never stored; windows which overlap it skip those weights.
+  uint32_t padding_h;   // Top and bottom
+  uint32_t padding_w;   // Left and right
 } conv_shape_t;
 
 typedef struct {
@@ -35,7 +43,51 @@ typedef struct {
   uint32_t stride;        // In pixels.
 } pool_shape_t;
 
+// Activation functions which can be applied to a layer's output.
+enum Activation {
+  ACTIVATION_NONE,
+  ACTIVATION_RELU,  // max(x, 0)
+  ACTIVATION_RELU6, // min(max(x, 0), activation_max), the representation of 6
+  ACTIVATION_CLAMP  // min(max(x, activation_min), activation_max)
+};
+
+// Extra work to do on each output value of a layer, applied in this order.
+typedef struct {
+  // One value per output channel to add, or NULL.
+  const data_t* bias;
+
+  // Arithmetic right shift (rounding to nearest) to requantise the result.
+  uint32_t shift;
+
+  enum Activation activation;
+  data_t activation_min;
+  data_t activation_max;
+
+  // If not NULL, also compute a 2x2 max pool (stride 2) of the result into
+  // this tensor.
+  activation_config_t* pool_output;
+} epilogue_t;
+
+// Maximum number of loops in a nest used by an asynchronous computation.
+#ifndef LAT_MAX_ASYNC_LOOPS
+#define LAT_MAX_ASYNC_LOOPS 16
+#endif
+
+// Space (in bytes) for the state of an asynchronous computation.
+#define LAT_HANDLE_SIZE (512 + 32 * LAT_MAX_ASYNC_LOOPS)
+
+// State of an asynchronous computation. Contents are internal: use only with
+// `lat_poll` and `lat_wait`. The handle must not be moved or reused until the
+// computation has completed.
+typedef struct {
+  uint64_t storage[LAT_HANDLE_SIZE / sizeof(uint64_t)];
+} lat_handle_t;
+
 // 2D convolution - the standard in CNNs for visual data.
+// If `loop_order` is NULL, a loop nest is chosen automatically (see tuning.h).
+// Results are accumulated into `output`, so it must be cleared first unless
+// it already holds something to add to. e.g. for a residual connection
+// `conv(x) + skip`, pass `skip` as the output; no separate addition is needed.
 void lat_conv2d(
   const activation_config_t* input,
   const filter_config_t* weights,
@@ -44,10 +96,41 @@ void lat_conv2d(
   const loop_nest_t* loop_order
 );
 
+// A view of part of `tensor`, starting at the given position. No data is
+// copied, and the view has the same strides as `tensor`, so it can be used as
+// the input or output of any layer. e.g. concatenating the outputs of two
+// layers along the channel dimension needs no copy if each layer writes to a
+// slice of the combined tensor, starting at its first channel.
+activation_config_t lat_activation_slice(const activation_config_t* tensor,
+                                         uint32_t first_image,
+                                         uint32_t first_channel,
+                                         uint32_t first_row,
+                                         uint32_t first_column);
+
+// 2D transposed convolution, used for learned upsampling (e.g. in decoders).
+// Each input value is scattered into the output, so no multiplications by
+// inserted zeros are done. `image_width` and `image_height` are the size of
+// the input, and the output is
+//   (input - 1) * stride + dilation * (filter - 1) + 1 - 2 * padding
+// in each dimension (PyTorch's `output_padding` is not supported). Weights
+// are indexed by input channel and output channel as for `lat_conv2d`, so
+// weights stored as PyTorch's [in][out][h][w] just need suitable strides.
+// Only IMAGE_*, FILTER_*_IS, channel, BATCH and GROUPS loops are supported.
+// If `loop_order` is NULL, `LOOP_NEST_INPUT_STATIONARY` is used.
+// As with `lat_conv2d`, results are accumulated into the output.
+void lat_conv_transpose2d(
+  const activation_config_t* input,
+  const filter_config_t* weights,
+  activation_config_t* output,
+  const conv_shape_t* params,
+  const loop_nest_t* loop_order
+);
+
 // Linear/fully-connected layer. Used for classification and multi-layer
 // perceptrons.
 // Currently requires 4D weights and activations, to match the convolution
 // interface. Use 1 for any width/height parameters.
+// As with `lat_conv2d`, results are accumulated into `output`.
 void lat_linear(
   const activation_config_t* input,
   const filter_config_t* weights,
@@ -58,6 +141,222 @@ void lat_linear(
   const loop_nest_t* loop_order
 );
 
+// Same as `lat_conv2d` and `lat_linear`, but the output's previous contents
+// are replaced rather than accumulated into, so it doesn't need to be cleared
+// first. Only the part of `output` covered by the layer is written, so the
+// output may be a slice of a larger tensor (see `lat_activation_slice`), e.g.
+// one layer's channels of a concatenation. The covered part of the output is
+// cleared, then computed in a single launch.
+void lat_conv2d_overwrite(
+  const activation_config_t* input,
+  const filter_config_t* weights,
+  activation_config_t* output,
+  const conv_shape_t* params,
+  const loop_nest_t* loop_order
+);
+
+void lat_linear_overwrite(
+  const activation_config_t* input,
+  const filter_config_t* weights,
+  activation_config_t* output,
+  uint32_t batch_size,
+  uint32_t num_inputs,
+  uint32_t num_outputs,
+  const loop_nest_t* loop_order
+);
+
+// 2D convolution and linear layers followed by an epilogue (bias, activation,
+// etc.), which is applied in a single pass over the output. Results are
+// accumulated into `output` before the epilogue, so a residual connection
+// followed by an activation can be computed by passing the skip tensor as the
+// output. The layer is split into chunks, and the calling core applies the
+// epilogue to each chunk while the accelerator computes the next one.
+void lat_conv2d_fused(
+  const activation_config_t* input,
+  const filter_config_t* weights,
+  activation_config_t* output,
+  const conv_shape_t* params,
+  const loop_nest_t* loop_order,
+  const epilogue_t* epilogue
+);
+
+void lat_linear_fused(
+  const activation_config_t* input,
+  const filter_config_t* weights,
+  activation_config_t* output,
+  uint32_t batch_size,
+  uint32_t num_inputs,
+  uint32_t num_outputs,
+  const loop_nest_t* loop_order,
+  const epilogue_t* epilogue
+);
+
+// Dimension to split when computing a layer on multiple tiles.
+enum Partition {
+  PARTITION_AUTO,         // Choose automatically
+  PARTITION_OUT_CHANNELS, // Each tile reads only a fraction of the weights
+  PARTITION_BATCH,        // Each tile reads only a fraction of the input
+  PARTITION_ROWS          // Each tile computes a horizontal band of output
+                          // (not with padding_h: another option is used)
+};
+
+// 2D convolution split across the accelerators of `tiles` tiles. The calling
+// core must have initialised enough cores for this (e.g. `loki_init_default`),
+// and `tiles` * 2 cores are used. Blocks until all tiles have finished.
+void lat_conv2d_parallel(
+  const activation_config_t* input,
+  const filter_config_t* weights,
+  activation_config_t* output,
+  const conv_shape_t* params,
+  const loop_nest_t* loop_order,
+  uint32_t tiles,
+  enum Partition partition
+);
+
+// Asynchronous versions of `lat_conv2d` and `lat_linear`. Computation starts
+// on this tile's accelerator and the function returns immediately, allowing
+// the core to do other work. The returned handle is `handle`, which the caller
+// provides (so no memory allocation is needed). All tensors must remain valid
+// until the computation completes. Only one computation may be in progress on
+// each tile's accelerator at a time.
+lat_handle_t* lat_conv2d_async(
+  const activation_config_t* input,
+  const filter_config_t* weights,
+  activation_config_t* output,
+  const conv_shape_t* params,
+  const loop_nest_t* loop_order,
+  lat_handle_t* handle
+);
+
+lat_handle_t* lat_linear_async(
+  const activation_config_t* input,
+  const filter_config_t* weights,
+  activation_config_t* output,
+  uint32_t batch_size,
+  uint32_t num_inputs,
+  uint32_t num_outputs,
+  const loop_nest_t* loop_order,
+  lat_handle_t* handle
+);
+
+// Check whether an asynchronous computation has completed, without blocking.
+// Returns nonzero if it has. Must be called (or `lat_wait`) to make progress
+// through computations which need multiple accelerator launches.
+int lat_poll(lat_handle_t* handle);
+
+// Block until an asynchronous computation has completed.
+void lat_wait(lat_handle_t* handle);
+
+// A convolution or linear layer prepared in advance, so it can be run many
+// times on different data without recomputing the accelerator parameters.
+// Contents are internal and never change after creation.
+typedef struct {
+  lat_handle_t handle;  // Ready to launch, apart from data addresses
+} lat_plan_t;
+
+// Prepare a convolution. Strides and memory groups are taken from `input`
+// and `weights`; the output must use the default dimension order ([batch,
+// channels, height, width], with no gaps) and the same memory group as the
+// input. The weights must remain valid for the lifetime of the plan.
+// Returns NULL if there is not enough memory. Free with `lat_plan_destroy`.
+lat_plan_t* lat_conv2d_plan_create(
+  const activation_config_t* input,
+  const filter_config_t* weights,
+  const conv_shape_t* params,
+  const loop_nest_t* loop_order
+);
+
+lat_plan_t* lat_linear_plan_create(
+  const activation_config_t* input,
+  const filter_config_t* weights,
+  uint32_t batch_size,
+  uint32_t num_inputs,
+  uint32_t num_outputs,
+  const loop_nest_t* loop_order
+);
+
+void lat_plan_destroy(lat_plan_t* plan);
+
+// Run a plan with the given input and output data, which must have the layout
+// described when the plan was created. As with `lat_conv2d`, results are
+// accumulated into the output. A plan may be executed by any core, including
+// by several at once.
+void lat_plan_execute(
+  const lat_plan_t* plan,
+  const data_t* input,
+  data_t* output
+);
+
+// Asynchronous version of `lat_plan_execute`: see `lat_conv2d_async`.
+lat_handle_t* lat_plan_execute_async(
+  const lat_plan_t* plan,
+  const data_t* input,
+  data_t* output,
+  lat_handle_t* handle
+);
+
+// Copy weights into the order in which `loop_order` reads them, so the
+// accelerator's inner loops read them sequentially. Intended to be done once,
+// when a model is loaded. If `loop_order` is NULL, the nest which `lat_conv2d`
+// would choose is used. The result works with any nest, but is only
+// sequential for this one. Its data uses `loki_malloc` and the same memory
+// group as `weights`, and must be freed by the user. The data address is NULL
+// if there is not enough memory.
+filter_config_t lat_pack_weights(
+  const filter_config_t* weights,
+  const conv_shape_t* params,
+  const loop_nest_t* loop_order
+);
+
+// Settings for convolutions on `lat_tensor_t`s which can't be determined from
+// the tensors' shapes. See `conv_shape_t`; 0 means the default for all fields.
+typedef struct {
+  uint32_t groups;
+  uint32_t stride;
+  uint32_t dilation;
+  uint32_t padding_h;
+  uint32_t padding_w;
+} conv_options_t;
+
+// Versions of `lat_conv2d` and the pooling layers which take their sizes from
+// 4D tensors (activations [batch, channels, height, width], weights [out
+// channels, in channels per group, height, width]) with any layout. `options`
+// may be NULL to use the defaults. Only `DTYPE_DATA` is supported.
+// As with `lat_conv2d`, results are accumulated into `output`, which may be a
+// slice of a larger tensor (see `lat_tensor_slice`).
+void lat_conv2d_tensor(
+  const lat_tensor_t* input,
+  const lat_tensor_t* weights,
+  lat_tensor_t* output,
+  const conv_options_t* options,
+  const loop_nest_t* loop_order
+);
+
+void lat_max_pool_2d_tensor(
+  const lat_tensor_t* input,
+  lat_tensor_t* output,
+  uint32_t window_height,
+  uint32_t window_width,
+  uint32_t stride
+);
+
+void lat_avg_pool_2d_tensor(
+  const lat_tensor_t* input,
+  lat_tensor_t* output,
+  uint32_t window_height,
+  uint32_t window_width,
+  uint32_t stride
+);
+
+// Number of cores which CPU-side layers (e.g. pooling) may use. Work is split
+// evenly between cores (on as many tiles as needed), which must already have
+// been initialised (e.g. `loki_init_default`). Default: 1.
+void lat_set_cpu_cores(uint32_t cores);
+
+// Enable (nonzero) or disable (0) notes about layers which run unoptimised on
+// the CPU. Default: enabled.
+void lat_set_warnings(int enabled);
+
 // Downsample input by taking the maximum value in each window.
 void lat_max_pool_2d(
   const activation_config_t* input,
@@ -73,12 +372,27 @@ void lat_avg_pool_2d(
 );
 
 
+// The following functions allocate their output. If `arena` is not NULL, the
+// output is allocated from it, in the arena's memory group. Otherwise, the
+// output uses `loki_malloc` and the same memory group as the input, and the
+// user must `loki_free` both the tensor and its data.
+
 // 2D convolution with automatic allocation of output buffer.
 activation_config_t* lat_conv2d_alloc(
   const activation_config_t* input,
   const filter_config_t* weights,
   const conv_shape_t* params,
-  const loop_nest_t* loop_order
+  const loop_nest_t* loop_order,
+  lat_arena_t* arena
+);
+
+// 2D transposed convolution with automatic allocation of output buffer.
+activation_config_t* lat_conv_transpose2d_alloc(
+  const activation_config_t* input,
+  const filter_config_t* weights,
+  const conv_shape_t* params,
+  const loop_nest_t* loop_order,
+  lat_arena_t* arena
 );
 
 // Linear/fully-connected layer with automatic allocation of output buffer.
@@ -90,19 +404,22 @@ activation_config_t* lat_linear_alloc(
   uint32_t batch_size,
   uint32_t num_inputs,
   uint32_t num_outputs,
-  const loop_nest_t* loop_order
+  const loop_nest_t* loop_order,
+  lat_arena_t* arena
 );
 
 // Downsample input by taking the maximum value in each window.
 activation_config_t* lat_max_pool_2d_alloc(
   const activation_config_t* input,
-  const pool_shape_t* params
+  const pool_shape_t* params,
+  lat_arena_t* arena
 );
 
 // Downsample input by taking the average value in each window.
 activation_config_t* lat_avg_pool_2d_alloc(
   const activation_config_t* input,
-  const pool_shape_t* params
+  const pool_shape_t* params,
+  lat_arena_t* arena
 );
 
 #endif // include guard
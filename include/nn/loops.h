@@ -1,6 +1,8 @@
 #ifndef LAT_NN_LOOPS_H
 #define LAT_NN_LOOPS_H
 
+#include <stdint.h>
+
 // Possible dimensions that loops can iterate over.
 // Not all dimensions apply to all computations.
 enum Loop {
@@ -12,7 +14,10 @@ enum Loop {
   FILTER_WIDTH_OS,  // output stationary
   FILTER_HEIGHT_OS, // output stationary
   FILTER_WIDTH_IS,  // input stationary
-  FILTER_HEIGHT_IS  // input stationary
+  FILTER_HEIGHT_IS, // input stationary
+  IN_CHANNEL_TILES, // steps between tiles; IN_CHANNELS steps within a tile
+  OUT_CHANNEL_TILES,// steps between tiles; OUT_CHANNELS steps within a tile
+  GROUPS            // steps between groups; channel loops step within a group
 };
 
 // A collection of loops, from outermost to innermost.
@@ -25,9 +30,30 @@ enum Loop {
 //
 // Loop nests may reasonably have more loops (e.g. if loop tiling is used) or
 // fewer loops (e.g. if some dimensions are known to be size 1).
+// Before launching, loops with one iteration are removed and loops which step
+// through memory contiguously are merged, so general nests lose nothing on
+// e.g. linear layers.
+//
+// Channel dimensions can be tiled by including IN_CHANNEL_TILES or
+// OUT_CHANNEL_TILES as an outer loop and setting the corresponding tile size.
+// The untiled loop then iterates within one tile. e.g.
+//   {OUT_CHANNEL_TILES, IN_CHANNEL_TILES, BATCH, OUT_CHANNELS, IMAGE_HEIGHT,
+//    IMAGE_WIDTH, FILTER_HEIGHT_OS, FILTER_WIDTH_OS, IN_CHANNELS}
+// This limits the working set of each tile so it can stay in local memory.
+// Dimensions do not need to be a multiple of the tile size: any partial tile
+// at the end is computed separately.
+//
+// Grouped convolutions (including depthwise, where there is one input channel
+// per group) iterate over groups with a GROUPS loop. If a nest without one is
+// used for a grouped convolution, GROUPS is added as the outermost loop.
 typedef struct {
   unsigned int loop_count;
   enum Loop* loops;
+
+  // Number of channels in each tile. 0 means the whole dimension is one tile.
+  // Ignored if the corresponding `*_TILES` loop is not present.
+  uint32_t in_channel_tile;
+  uint32_t out_channel_tile;
 } loop_nest_t;
 
 
@@ -0,0 +1,85 @@
+#ifndef LAT_NN_NETWORK_H
+#define LAT_NN_NETWORK_H
+
+#include "layers.h"
+
+// A network is a sequence of layers, each of which reads the output of the
+// network input or an earlier layer. All intermediate tensors are planned when
+// the network is created: tensors which are never live at the same time share
+// a buffer, so the memory needed is much less than the sum of all outputs,
+// and nothing is allocated while the network runs.
+
+enum LayerType {
+  LAYER_CONV2D,
+  LAYER_LINEAR,
+  LAYER_MAX_POOL_2D,
+  LAYER_AVG_POOL_2D
+};
+
+// `lat_layer_t::input` value meaning the network's input.
+#define LAT_NETWORK_INPUT (-1)
+
+typedef struct {
+  uint32_t batch_size;
+  uint32_t num_inputs;
+  uint32_t num_outputs;
+} linear_shape_t;
+
+// Description of one layer. Only the shape matching `type` is used.
+typedef struct {
+  enum LayerType type;
+
+  // Index of the layer whose output this layer reads, or LAT_NETWORK_INPUT.
+  // Must be less than this layer's index.
+  int input;
+
+  // Convolution and linear layers only. `loop_order` may be NULL (see
+  // `lat_conv2d`). If `epilogue` is not NULL, the layer is computed with
+  // `lat_conv2d_fused`/`lat_linear_fused`; its `pool_output` must be NULL
+  // (use a separate pooling layer).
+  const filter_config_t* weights;
+  const loop_nest_t*     loop_order;
+  const epilogue_t*      epilogue;
+
+  conv_shape_t   conv;
+  linear_shape_t linear;
+  pool_shape_t   pool;
+} lat_layer_t;
+
+typedef struct {
+  uint32_t           layer_count;
+  const lat_layer_t* layers;
+
+  // Output of each layer, pointing into one of the shared buffers.
+  activation_config_t* outputs;
+
+  // Number of distinct buffers, and total memory they use.
+  uint32_t buffer_count;
+  size_t   memory_size;
+
+  char*        memory;
+  lat_arena_t* arena;   // Arena `memory` came from, or NULL for `loki_malloc`
+} lat_network_t;
+
+// Plan a network. `layers` must remain valid for the lifetime of the network.
+// If `arena` is not NULL, everything is allocated from it (and freed when the
+// arena is reset). Otherwise, `loki_malloc` is used and the network must be
+// freed with `lat_network_destroy`. Intermediate tensors use memory group
+// `memory_config`. Returns NULL if there is not enough memory.
+lat_network_t* lat_network_create(
+  const lat_layer_t* layers,
+  uint32_t layer_count,
+  int memory_config,
+  lat_arena_t* arena
+);
+
+void lat_network_destroy(lat_network_t* network);
+
+// Run the whole network on `input`. Returns the output of the final layer,
+// which remains valid until the network is next run or destroyed.
+const activation_config_t* lat_network_run(
+  lat_network_t* network,
+  const activation_config_t* input
+);
+
+#endif // include guard
@@ -0,0 +1,99 @@
+#ifndef LAT_NN_QUANTIZED_H
+#define LAT_NN_QUANTIZED_H
+
+#include "layers.h"
+
+// Layers on quantised tensors, stored as DTYPE_INT8 or DTYPE_INT16. Each
+// element represents the real value `scale * (quantised - zero_point)`.
+//
+// This is a narrow storage format for activations: they stay narrow in memory
+// between layers, so take 2-4x less space. It does not reduce memory traffic
+// for convolutions. The accelerator computes with `data_t`, so each image is
+// widened into a scratch buffer just before it is used, and results are
+// requantised as soon as they are complete. Weights are widened once, in
+// advance (see `lat_quantized_filter_create`), and are stored wide. Pooling
+// works on the narrow values directly.
+
+// Quantisation of a tensor. Each array has one entry for the whole tensor, or
+// one entry per channel (output channel for weights).
+typedef struct {
+  uint32_t       count;       // 1 or number of channels
+  const float*   scale;
+  const int32_t* zero_point;
+} lat_quant_params_t;
+
+typedef struct {
+  lat_tensor_t       tensor;
+  lat_quant_params_t quant;
+} lat_qtensor_t;
+
+// Weights widened to `data_t` in advance, since the same weights are used for
+// every input.
+typedef struct {
+  // DTYPE_DATA, [out channels, in channels, rows, columns], with each
+  // channel's zero point already subtracted.
+  lat_tensor_t       tensor;
+
+  // Scales of the original weights. Zero points are all 0.
+  lat_quant_params_t quant;
+} lat_quantized_filter_t;
+
+// Widen weights for use with `lat_quantized_conv2d`. Weights may be
+// per-channel quantised. The original weights are no longer needed
+// afterwards. Free the result with `lat_quantized_filter_destroy`. Returns
+// NULL if there is not enough memory.
+lat_quantized_filter_t* lat_quantized_filter_create(
+  const lat_qtensor_t* weights
+);
+
+void lat_quantized_filter_destroy(lat_quantized_filter_t* filter);
+
+// Quantised 2D convolution. Input quantisation must be per-tensor; output may
+// be per-channel. `bias` may be NULL, or have one value per output channel,
+// quantised with scale `input scale * weight scale` and zero point 0. Output
+// values are rounded to nearest and saturated to the output type. Unlike
+// `lat_conv2d`, the output is overwritten rather than accumulated. Scratch
+// buffers for one image come from `arena` if it is not NULL, or from
+// `loki_malloc` (and are freed before returning) otherwise.
+void lat_quantized_conv2d(
+  const lat_qtensor_t* input,
+  const lat_quantized_filter_t* weights,
+  lat_qtensor_t* output,
+  const int32_t* bias,
+  const conv_options_t* options,
+  const loop_nest_t* loop_order,
+  lat_arena_t* arena
+);
+
+// Quantised linear layer. Activations are [batch, channels, 1, 1] and weights
+// [out channels, in channels, 1, 1].
+void lat_quantized_linear(
+  const lat_qtensor_t* input,
+  const lat_quantized_filter_t* weights,
+  lat_qtensor_t* output,
+  const int32_t* bias,
+  const loop_nest_t* loop_order,
+  lat_arena_t* arena
+);
+
+// Quantised pooling, computed on the calling core. The output should use the
+// same scales as the input. Max pooling compares stored values directly;
+// average pooling removes the zero points first, so rounds towards zero like
+// `lat_avg_pool_2d`.
+void lat_quantized_max_pool_2d(
+  const lat_qtensor_t* input,
+  lat_qtensor_t* output,
+  uint32_t window_height,
+  uint32_t window_width,
+  uint32_t stride
+);
+
+void lat_quantized_avg_pool_2d(
+  const lat_qtensor_t* input,
+  lat_qtensor_t* output,
+  uint32_t window_height,
+  uint32_t window_width,
+  uint32_t stride
+);
+
+#endif // include guard
@@ -0,0 +1,76 @@
+#ifndef LAT_NN_SPARSE_H
+#define LAT_NN_SPARSE_H
+
+#include "layers.h"
+
+// Weights with whole blocks of channels pruned to zero, stored in compressed
+// form. Output and input channels are divided into blocks, and only blocks
+// containing a nonzero weight are stored and computed.
+//
+// The format is compressed sparse rows, where each row is one block of output
+// channels. Neighbouring nonzero input blocks in a row are merged into a
+// single run, which is computed with one accelerator launch.
+
+// A run of consecutive nonzero input channel blocks in one output block.
+typedef struct {
+  uint32_t in_channel;   // First input channel
+  uint32_t in_channels;  // Number of input channels
+  uint32_t offset;       // Position of the weights in `data`, in elements
+} lat_sparse_run_t;
+
+typedef struct {
+  uint32_t out_block;     // Output channels per block
+  uint32_t in_block;      // Input channels per block
+
+  uint32_t out_channels;
+  uint32_t in_channels;
+  uint32_t filter_height;
+  uint32_t filter_width;
+
+  // Runs for output block `i` are `runs[row_start[i]]` to
+  // `runs[row_start[i+1] - 1]`.
+  uint32_t*         row_start;
+  lat_sparse_run_t* runs;
+
+  // Each run's weights are dense, with layout [out channel][in channel][row]
+  // [column].
+  memory_location_t data;
+} lat_sparse_filter_t;
+
+// Compress `weights` with the given block sizes. Only ungrouped convolutions
+// are supported. Free the result with `lat_sparse_filter_destroy`. Returns NULL
+// if there is not enough memory.
+lat_sparse_filter_t* lat_sparse_filter_create(
+  const filter_config_t* weights,
+  const conv_shape_t* params,
+  uint32_t out_block,
+  uint32_t in_block
+);
+
+void lat_sparse_filter_destroy(lat_sparse_filter_t* filter);
+
+// Fraction of weights which are stored (i.e. in nonzero blocks).
+float lat_sparse_filter_density(const lat_sparse_filter_t* filter);
+
+// Same as `lat_conv2d` and `lat_linear`, skipping pruned blocks. Results are
+// accumulated into `output`, so output blocks with no nonzero weights are
+// left unchanged.
+void lat_conv2d_sparse(
+  const activation_config_t* input,
+  const lat_sparse_filter_t* weights,
+  activation_config_t* output,
+  const conv_shape_t* params,
+  const loop_nest_t* loop_order
+);
+
+void lat_linear_sparse(
+  const activation_config_t* input,
+  const lat_sparse_filter_t* weights,
+  activation_config_t* output,
+  uint32_t batch_size,
+  uint32_t num_inputs,
+  uint32_t num_outputs,
+  const loop_nest_t* loop_order
+);
+
+#endif // include guard
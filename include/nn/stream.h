@@ -0,0 +1,56 @@
+#ifndef LAT_NN_STREAM_H
+#define LAT_NN_STREAM_H
+
+#include "layers.h"
+
+// Streaming computation of large batches. The batch is split into chunks of
+// images, and only two chunks of input and output are held in memory at once.
+// While the accelerator computes chunk k, the next chunk of input is staged
+// and the previous chunk of output is drained. If at least two CPU cores are
+// allowed (see `lat_set_cpu_cores`), staging and draining run on separate
+// cores.
+
+// Fill `buffer` with images [first, first+count) of the input, e.g. by
+// loading or converting them. `buffer` has the default dimension order.
+typedef void (*lat_stage_func_t)(void* context, uint32_t first,
+                                 uint32_t count, activation_config_t* buffer);
+
+// Consume images [first, first+count) of the output, e.g. by storing or
+// post-processing them. `buffer` has the default dimension order, and its
+// contents are only valid until this function returns.
+typedef void (*lat_drain_func_t)(void* context, uint32_t first,
+                                 uint32_t count,
+                                 const activation_config_t* buffer);
+
+typedef struct {
+  lat_stage_func_t stage;
+  lat_drain_func_t drain;
+  void*            context;     // Passed to `stage` and `drain`
+
+  // Images in each chunk. 0 means the batch is split into a few chunks.
+  uint32_t         chunk_size;
+} lat_stream_t;
+
+// Compute a convolution over `params->batch_size` images, supplied and
+// consumed in chunks by `stream`. Outputs are not accumulated: each chunk
+// starts from zero. Buffers come from `arena` if it is not NULL, or from
+// `loki_malloc` (and are freed before returning) otherwise.
+void lat_conv2d_stream(
+  const filter_config_t* weights,
+  const conv_shape_t* params,
+  const loop_nest_t* loop_order,
+  const lat_stream_t* stream,
+  lat_arena_t* arena
+);
+
+void lat_linear_stream(
+  const filter_config_t* weights,
+  uint32_t batch_size,
+  uint32_t num_inputs,
+  uint32_t num_outputs,
+  const loop_nest_t* loop_order,
+  const lat_stream_t* stream,
+  lat_arena_t* arena
+);
+
+#endif // include guard
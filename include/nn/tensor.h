@@ -1,9 +1,7 @@
-// TODO: create a tensor type which generalises all of the `config_t`s and
-//       exposes more information (e.g. size of each dimension).
-
 #ifndef LAT_NN_TENSOR_H
 #define LAT_NN_TENSOR_H
 
+#include <stddef.h>
 #include <lat/types.h>
 
 // Details of 4D activations in memory.
@@ -34,4 +32,77 @@ typedef struct {
   int32_t  group_stride;
 } filter_config_t;
 
+// Maximum number of dimensions of a `lat_tensor_t`.
+#ifndef LAT_MAX_DIMENSIONS
+#define LAT_MAX_DIMENSIONS 4
+#endif
+
+// Type of each element of a tensor. Layers compute with `data_t`; other types
+// can only be stored and converted.
+enum DataType {
+  DTYPE_DATA,   // data_t
+  DTYPE_INT16,
+  DTYPE_INT8
+};
+
+// Order of a 4D tensor's dimensions in memory, outermost first. Activations
+// are always indexed [batch, channel, row, column] and weights [out channel,
+// in channel, row, column], whatever the layout.
+enum Layout {
+  LAYOUT_NCHW,  // Default for activations
+  LAYOUT_NHWC,  // Channels innermost
+  LAYOUT_OIHW,  // Default for weights (same order as NCHW)
+  LAYOUT_HWIO   // Filter position outermost, output channels innermost
+};
+
+// A tensor of any shape, which generalises `activation_config_t` and
+// `filter_config_t` by also recording the size of each dimension.
+typedef struct {
+  memory_location_t data;
+  enum DataType     dtype;
+
+  uint32_t dimensions;
+  uint32_t shape[LAT_MAX_DIMENSIONS];
+
+  // Distance (in bytes) between elements in each dimension. Negative offsets
+  // are allowed.
+  int32_t  strides[LAT_MAX_DIMENSIONS];
+} lat_tensor_t;
+
+// Size (in bytes) of one element of the given type.
+size_t lat_dtype_size(enum DataType dtype);
+
+// Set up a tensor with the given shape, with elements stored contiguously and
+// the last dimension innermost.
+void lat_tensor_init(lat_tensor_t* tensor, memory_location_t data,
+                     enum DataType dtype, uint32_t dimensions,
+                     const uint32_t* shape);
+
+// Set up a contiguous 4D tensor with the given layout. Sizes are given in the
+// logical order, e.g. [batch, channels, height, width], whatever the layout.
+void lat_tensor_init_4d(lat_tensor_t* tensor, memory_location_t data,
+                        enum DataType dtype, uint32_t d0, uint32_t d1,
+                        uint32_t d2, uint32_t d3, enum Layout layout);
+
+// Number of elements in the tensor.
+size_t lat_tensor_elements(const lat_tensor_t* tensor);
+
+// A view of elements [first, first+count) of the given dimension of `tensor`,
+// sharing its data. e.g. a channel range of a concatenated tensor, which a
+// layer can write into directly.
+lat_tensor_t lat_tensor_slice(const lat_tensor_t* tensor, uint32_t dimension,
+                              uint32_t first, uint32_t count);
+
+// Copy all elements of `src` to `dst`, which must have the same shape and
+// type but may have any strides, e.g. to convert between layouts. Work is
+// split between CPU cores (see `lat_set_cpu_cores`). The tensors must not
+// overlap.
+void lat_tensor_convert(const lat_tensor_t* src, lat_tensor_t* dst);
+
+// Views of 4D tensors for use with the rest of the library. No data is
+// copied. Grouped weights are assumed to have each group's output channels
+// together.
+activation_config_t lat_activation_view(const lat_tensor_t* tensor);
+filter_config_t lat_filter_view(const lat_tensor_t* tensor, uint32_t groups);
+
 #endif // include guard
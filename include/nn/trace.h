@@ -0,0 +1,68 @@
+#ifndef LAT_NN_TRACE_H
+#define LAT_NN_TRACE_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+// Optional instrumentation of the library's layers, for finding which layers
+// and phases of a model are slow.
+//
+// Tracing is only compiled in if the library is built with `LAT_TRACE`
+// defined (`make TRACE=1`). Otherwise these functions still exist, but
+// nothing is recorded. When compiled in, nothing is recorded until
+// `lat_trace_start` is called, and each instrumented call costs one branch.
+//
+// Each core records events in its own fixed-size ring buffer, so recording
+// needs no locks. When a buffer is full, its oldest events are overwritten.
+// Timestamps are cycle counts.
+
+// Maximum number of cores which can record events, and number of events kept
+// for each core.
+#define LAT_TRACE_MAX_CORES   16
+#define LAT_TRACE_BUFFER_SIZE 1024
+
+enum TraceEvent {
+  TRACE_CONV2D,      // A whole convolution or linear layer on the accelerator
+  TRACE_SETUP,       // Computing accelerator parameters
+  TRACE_ACCELERATE,  // Sending one part of a computation to the accelerator
+  TRACE_SYNC,        // Waiting for the accelerator to finish one part
+  TRACE_CLEAR,       // Clearing memory before accumulating into it
+  TRACE_POOL,        // A whole pooling layer, computed on the CPU
+
+  TRACE_EVENT_COUNT
+};
+
+typedef struct {
+  uint64_t        start;   // Cycle count
+  uint64_t        end;
+  enum TraceEvent event;
+  uint32_t        core;
+  uint64_t        macs;    // Multiply-accumulates, if known
+  uint64_t        bytes;   // Estimated memory traffic, if known
+} lat_trace_event_t;
+
+// Discard any previously-recorded events and start recording.
+void lat_trace_start(void);
+
+// Stop recording. Events remain available until the next `lat_trace_start`.
+void lat_trace_stop(void);
+
+// Name of an event type, as used in dumps.
+const char* lat_trace_event_name(enum TraceEvent event);
+
+// Copy up to `max_events` recorded events from the given core into `events`,
+// oldest first. Returns the number copied.
+uint32_t lat_trace_events(uint32_t core, lat_trace_event_t* events,
+                          uint32_t max_events);
+
+// Write all recorded events in Chrome's trace event format, which can be
+// viewed with chrome://tracing or Perfetto. Each core is one thread.
+// Timestamps are cycles, but the viewer will label them as microseconds.
+// Should only be called while no layers are running.
+void lat_trace_dump_chrome(FILE* stream);
+
+// Write a table with the number of events of each type, their total and
+// average duration, and the total MACs and bytes.
+void lat_trace_dump_summary(FILE* stream);
+
+#endif // include guard
@@ -0,0 +1,53 @@
+#ifndef LAT_NN_TUNING_H
+#define LAT_NN_TUNING_H
+
+#include "layers.h"
+#include "loops.h"
+
+// Dimensions of the accelerator's processing element array. The two innermost
+// loops of a nest are spread across these.
+#ifndef LAT_ACCELERATOR_ROWS
+#define LAT_ACCELERATOR_ROWS 4
+#endif
+#ifndef LAT_ACCELERATOR_COLUMNS
+#define LAT_ACCELERATOR_COLUMNS 4
+#endif
+
+// Maximum number of shapes whose loop nests can be remembered.
+#ifndef LAT_LOOP_NEST_CACHE_SIZE
+#define LAT_LOOP_NEST_CACHE_SIZE 64
+#endif
+
+// Choose a loop nest for the given convolution. If the shape has been seen
+// before (or loaded from a file), the previous choice is reused. Otherwise,
+// each of the predefined nests is scored using a simple model of memory
+// traffic and accelerator utilisation, and the cheapest is remembered.
+//
+// LOOP_NEST_INPUT_STATIONARY is never chosen, as it requires the output buffer
+// to be offset by the caller.
+const loop_nest_t* lat_choose_loop_nest(const conv_shape_t* shape);
+
+// Estimated cost (arbitrary units, lower is better) of computing the given
+// convolution with the given loop nest.
+uint32_t lat_loop_nest_cost(const conv_shape_t* shape, const loop_nest_t* nest);
+
+// Estimated number of bytes moved between memory and the accelerator when
+// computing the given convolution with the given loop nest.
+uint64_t lat_loop_nest_traffic(const conv_shape_t* shape,
+                               const loop_nest_t* nest);
+
+// Force the given loop nest to be used for this shape, e.g. after measuring
+// all options. `nest` must be one of the predefined `LOOP_NEST_*`s.
+void lat_loop_nest_cache_insert(const conv_shape_t* shape,
+                                const loop_nest_t* nest);
+
+// Remove all remembered choices.
+void lat_loop_nest_cache_clear(void);
+
+// Read/write remembered choices from/to a text file, so tuning only needs to
+// happen once per network. Loaded entries are added to any existing ones.
+// Return 0 on success, or -1 if the file could not be accessed.
+int lat_loop_nest_cache_load(const char* filename);
+int lat_loop_nest_cache_save(const char* filename);
+
+#endif // include guard
@@ -0,0 +1,58 @@
+#ifndef LAT_NN_WINOGRAD_H
+#define LAT_NN_WINOGRAD_H
+
+#include "layers.h"
+
+// Winograd convolution computes each m x m tile of output from an
+// (m+2) x (m+2) tile of input with (m+2)^2 multiplies per input/output channel
+// pair, instead of 9m^2. The input and output transforms run on the calling
+// core, and the multiplications run on the accelerator as one batched 1x1
+// convolution (grouped by position within the tile).
+//
+// Only 3x3 filters with stride 1, dilation 1 and one group are supported.
+// Results are exact: the filter transform is scaled to use integers, and the
+// scale is divided out at the end. Intermediate values are larger than with
+// direct convolution (by 4x for F(2x2,3x3) and 576x for F(4x4,3x3), before the
+// transforms' own growth), so F(4x4,3x3) needs more headroom in `data_t`.
+enum Winograd {
+  WINOGRAD_F2X2_3X3,  // 2.25x fewer multiplies
+  WINOGRAD_F4X4_3X3   // 4x fewer multiplies
+};
+
+// Weights transformed in advance, since the same weights are used for every
+// input.
+typedef struct {
+  enum Winograd   variant;
+  uint32_t        in_channels;
+  uint32_t        out_channels;
+
+  // Layout: [tile position][out channel][in channel].
+  filter_config_t weights;
+} lat_winograd_filter_t;
+
+// Transform weights for use with `lat_conv2d_winograd`. The original weights
+// are no longer needed afterwards. Free the result with
+// `lat_winograd_filter_destroy`. Returns NULL if there is not enough memory.
+lat_winograd_filter_t* lat_winograd_filter_create(
+  const filter_config_t* weights,
+  const conv_shape_t* params,
+  enum Winograd variant
+);
+
+void lat_winograd_filter_destroy(lat_winograd_filter_t* filter);
+
+// Same as `lat_conv2d`, using Winograd's algorithm. Results are accumulated
+// into `output`. `loop_order` is used for the batched multiplication, which
+// has a 1x1 filter, and may be NULL. Transformed tiles are held in buffers
+// from `arena` if it is not NULL, or from `loki_malloc` (and are freed before
+// returning) otherwise.
+void lat_conv2d_winograd(
+  const activation_config_t* input,
+  const lat_winograd_filter_t* weights,
+  activation_config_t* output,
+  const conv_shape_t* params,
+  const loop_nest_t* loop_order,
+  lat_arena_t* arena
+);
+
+#endif // include guard
@@ -0,0 +1,72 @@
+#include <loki/alloc.h>
+#include "nn/arena.h"
+
+lat_arena_t* lat_arena_create(size_t size, int memory_config) {
+  lat_arena_t* arena = loki_malloc(sizeof(lat_arena_t));
+  if (arena == NULL)
+    return NULL;
+
+  // Over-allocate so the first allocation can be aligned.
+  void* memory = loki_malloc(size + LAT_ARENA_ALIGNMENT);
+  if (memory == NULL) {
+    loki_free(arena);
+    return NULL;
+  }
+
+  lat_arena_init(arena, memory, size + LAT_ARENA_ALIGNMENT, memory_config);
+  arena->owns_memory = 1;
+
+  return arena;
+}
+
+void lat_arena_init(lat_arena_t* arena, void* memory, size_t size,
+                    int memory_config) {
+  arena->base = memory;
+  arena->size = size;
+  arena->used = 0;
+  arena->memory_config = memory_config;
+  arena->owns_memory = 0;
+
+  // Skip bytes at the start so all allocations are aligned.
+  size_t misalignment = (size_t)arena->base % LAT_ARENA_ALIGNMENT;
+  if (misalignment != 0)
+    arena->used = LAT_ARENA_ALIGNMENT - misalignment;
+}
+
+void lat_arena_destroy(lat_arena_t* arena) {
+  if (arena->owns_memory) {
+    loki_free(arena->base);
+    loki_free(arena);
+  }
+}
+
+void lat_arena_reset(lat_arena_t* arena) {
+  size_t misalignment = (size_t)arena->base % LAT_ARENA_ALIGNMENT;
+  arena->used = (misalignment == 0) ? 0 : LAT_ARENA_ALIGNMENT - misalignment;
+}
+
+void* lat_arena_alloc(lat_arena_t* arena, size_t size) {
+  // Checked before padding, so the padding can't overflow.
+  if (size > arena->size)
+    return NULL;
+
+  size_t padded = (size + LAT_ARENA_ALIGNMENT - 1) &
+                  ~(size_t)(LAT_ARENA_ALIGNMENT - 1);
+
+  // Claim space atomically so cores on any tile can allocate concurrently.
+  // Space is only claimed if it fits, so a failed allocation leaves the arena
+  // usable for smaller ones.
+  size_t offset = __atomic_load_n(&arena->used, __ATOMIC_RELAXED);
+  do {
+    if (padded > arena->size || offset > arena->size - padded)
+      return NULL;
+  } while (!__atomic_compare_exchange_n(&arena->used, &offset,
+                                        offset + padded, 1, __ATOMIC_RELAXED,
+                                        __ATOMIC_RELAXED));
+
+  return arena->base + offset;
+}
+
+size_t lat_arena_used(const lat_arena_t* arena) {
+  return __atomic_load_n(&arena->used, __ATOMIC_RELAXED);
+}
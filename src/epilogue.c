@@ -0,0 +1,247 @@
+#include "nn/layers.h"
+#include "nn/tuning.h"
+#include "internal.h"
+
+// Number of pieces a convolution is split into, so the epilogue of one piece
+// can overlap computation of the next. Each piece streams the weights it
+// uses, so this is kept small.
+#ifndef EPILOGUE_CHUNKS
+#define EPILOGUE_CHUNKS 4
+#endif
+
+static inline data_t* element(const activation_config_t* tensor, uint b,
+                              uint ch, uint row, uint col) {
+  return tensor->data.address + (b*tensor->batch_stride +
+         ch*tensor->channel_stride + row*tensor->row_stride +
+         col*tensor->column_stride) / (int)sizeof(data_t);
+}
+
+// Apply everything except pooling to one value.
+static inline data_t finish(data_t value, data_t bias,
+                            const epilogue_t* epilogue) {
+  value += bias;
+
+  // Round to nearest when requantising.
+  if (epilogue->shift > 0)
+    value = (value + (1 << (epilogue->shift - 1))) >> epilogue->shift;
+
+  switch (epilogue->activation) {
+    case ACTIVATION_RELU:
+      if (value < 0)
+        value = 0;
+      break;
+
+    case ACTIVATION_RELU6:
+      if (value < 0)
+        value = 0;
+      else if (value > epilogue->activation_max)
+        value = epilogue->activation_max;
+      break;
+
+    case ACTIVATION_CLAMP:
+      if (value < epilogue->activation_min)
+        value = epilogue->activation_min;
+      else if (value > epilogue->activation_max)
+        value = epilogue->activation_max;
+      break;
+
+    case ACTIVATION_NONE:
+    default:
+      break;
+  }
+
+  return value;
+}
+
+// Apply the epilogue to images [first_image, first_image+images) and channels
+// [first_channel, first_channel+channels) of the output, in a single pass.
+// Pooling happens immediately after each pair of rows is finished, while
+// they're still in the cache.
+static void apply_epilogue(activation_config_t* output, uint height,
+                           uint width, uint first_image, uint images,
+                           uint first_channel, uint channels,
+                           const epilogue_t* epilogue) {
+  activation_config_t* pooled = epilogue->pool_output;
+
+  for (uint b=first_image; b<first_image+images; b++) {
+    for (uint ch=first_channel; ch<first_channel+channels; ch++) {
+      data_t bias = (epilogue->bias == NULL) ? 0 : epilogue->bias[ch];
+
+      for (uint row=0; row<height; row++) {
+        for (uint col=0; col<width; col++) {
+          data_t* ptr = element(output, b, ch, row, col);
+          *ptr = finish(*ptr, bias, epilogue);
+        }
+
+        // 2x2 max pooling with stride 2. Incomplete windows are dropped.
+        if (pooled != NULL && (row & 1)) {
+          for (uint col=0; col+1<width; col+=2) {
+            data_t max = *element(output, b, ch, row-1, col);
+            data_t v = *element(output, b, ch, row-1, col+1);
+            if (v > max) max = v;
+            v = *element(output, b, ch, row, col);
+            if (v > max) max = v;
+            v = *element(output, b, ch, row, col+1);
+            if (v > max) max = v;
+
+            *element(pooled, b, ch, row >> 1, col >> 1) = max;
+          }
+        }
+      }
+    }
+  }
+}
+
+void conv_chunked(
+  const activation_config_t* input,
+  const filter_config_t* weights,
+  activation_config_t* output,
+  const conv_shape_t* params,
+  const loop_nest_t* loop_order,
+  const epilogue_t* epilogue,
+  int overwrite
+) {
+  // Choose for the whole layer, not for each chunk.
+  if (loop_order == NULL)
+    loop_order = lat_choose_loop_nest(params);
+
+  uint height = conv_output_height(params);
+  uint width = conv_output_width(params);
+
+  // Split the computation into chunks: groups of images if there are several,
+  // or output channels otherwise. Grouped convolutions are not split by
+  // channel. Each chunk may stream all of the weights again, which only pays
+  // off if there is an epilogue to overlap. Without one, the output is
+  // cleared and then computed in a single launch.
+  int by_image = params->batch_size > 1;
+  uint32_t chunks = (epilogue == NULL) ? 1 :
+                    (!by_image && conv_groups(params) > 1) ? 1 :
+                    EPILOGUE_CHUNKS;
+  uint32_t total = by_image ? params->batch_size : params->out_channels;
+  if (chunks > total)
+    chunks = total;
+
+  // Only one computation may be in progress on the accelerator at a time, so
+  // one handle is enough.
+  lat_handle_t handle;
+  activation_config_t chunk_input = *input;
+  filter_config_t chunk_weights = *weights;
+  activation_config_t chunk_output = *output;
+  conv_shape_t chunk_shape = *params;
+
+  uint32_t first = 0, count = 0;
+  uint32_t next_first, next_count;
+
+  if (overwrite && chunks > 0) {
+    split_work(total, chunks, 0, &next_first, &next_count);
+    if (by_image)
+      clear_activations(output, next_first, next_count, 0,
+                        params->out_channels, height, width);
+    else
+      clear_activations(output, 0, params->batch_size, next_first,
+                        next_count, height, width);
+  }
+
+  for (uint32_t chunk=0; chunk<=chunks; chunk++) {
+    uint32_t prev_first = first, prev_count = count;
+
+    // Start computing this chunk...
+    if (chunk < chunks) {
+      split_work(total, chunks, chunk, &first, &count);
+
+      if (by_image) {
+        chunk_input.data = offset_location(input->data,
+                                           first * input->batch_stride);
+        chunk_output.data = offset_location(output->data,
+                                            first * output->batch_stride);
+        chunk_shape.batch_size = count;
+      }
+      else {
+        chunk_weights.data = offset_location(weights->data,
+            first * weights->out_channel_stride);
+        chunk_output.data = offset_location(output->data,
+                                            first * output->channel_stride);
+        chunk_shape.out_channels = count;
+      }
+
+      lat_conv2d_async(&chunk_input, &chunk_weights, &chunk_output,
+                       &chunk_shape, loop_order, &handle);
+    }
+
+    // ... while finishing the previous one...
+    if (chunk > 0 && epilogue != NULL) {
+      if (by_image)
+        apply_epilogue(output, height, width, prev_first, prev_count,
+                       0, params->out_channels, epilogue);
+      else
+        apply_epilogue(output, height, width, 0, params->batch_size,
+                       prev_first, prev_count, epilogue);
+    }
+
+    // ... and clearing the next one.
+    if (overwrite && chunk + 1 < chunks) {
+      split_work(total, chunks, chunk + 1, &next_first, &next_count);
+      if (by_image)
+        clear_activations(output, next_first, next_count, 0,
+                          params->out_channels, height, width);
+      else
+        clear_activations(output, 0, params->batch_size, next_first,
+                          next_count, height, width);
+    }
+
+    if (chunk < chunks)
+      lat_wait(&handle);
+  }
+}
+
+void lat_conv2d_fused(
+  const activation_config_t* input,
+  const filter_config_t* weights,
+  activation_config_t* output,
+  const conv_shape_t* params,
+  const loop_nest_t* loop_order,
+  const epilogue_t* epilogue
+) {
+  conv_chunked(input, weights, output, params, loop_order, epilogue, 0);
+}
+
+void lat_linear_fused(
+  const activation_config_t* input,
+  const filter_config_t* weights,
+  activation_config_t* output,
+  uint32_t batch_size,
+  uint32_t num_inputs,
+  uint32_t num_outputs,
+  const loop_nest_t* loop_order,
+  const epilogue_t* epilogue
+) {
+  conv_shape_t conv;
+  linear_shape(&conv, batch_size, num_inputs, num_outputs);
+
+  lat_conv2d_fused(input, weights, output, &conv, loop_order, epilogue);
+}
+
+void lat_conv2d_overwrite(
+  const activation_config_t* input,
+  const filter_config_t* weights,
+  activation_config_t* output,
+  const conv_shape_t* params,
+  const loop_nest_t* loop_order
+) {
+  conv_chunked(input, weights, output, params, loop_order, NULL, 1);
+}
+
+void lat_linear_overwrite(
+  const activation_config_t* input,
+  const filter_config_t* weights,
+  activation_config_t* output,
+  uint32_t batch_size,
+  uint32_t num_inputs,
+  uint32_t num_outputs,
+  const loop_nest_t* loop_order
+) {
+  conv_shape_t conv;
+  linear_shape(&conv, batch_size, num_inputs, num_outputs);
+
+  conv_chunked(input, weights, output, &conv, loop_order, NULL, 1);
+}
@@ -0,0 +1,305 @@
+// Functions shared between source files, but not part of the public interface.
+
+#ifndef LAT_NN_INTERNAL_H
+#define LAT_NN_INTERNAL_H
+
+#include <sys/types.h>
+#include "nn/layers.h"
+#include "nn/trace.h"
+
+// Loki is assumed to be configured with two cores and one accelerator on each
+// tile.
+#define LAT_CORES_PER_TILE 2
+
+// Split `total` items as evenly as possible into `parts` parts, and return the
+// first item and number of items in part `index`.
+static inline void split_work(uint32_t total, uint32_t parts, uint32_t index,
+                              uint32_t* first, uint32_t* count) {
+  uint32_t base = total / parts;
+  uint32_t extra = total % parts;
+
+  // The first `extra` parts get one extra item each.
+  *count = base + ((index < extra) ? 1 : 0);
+  *first = index * base + ((index < extra) ? index : extra);
+}
+
+// Determine how large the output will be (in pixels), given the computation
+// parameters. This applies to any windowed computation, e.g. convolution,
+// pooling.
+// The equation is taken from PyTorch (minus the `padding` parameter, which
+// callers add to `input_size` where needed):
+// https://pytorch.org/docs/stable/nn.html#conv2d
+uint output_size(uint input_size, uint window_size, uint stride, uint dilation);
+
+// Position of the given loop in the nest, or -1 if it is not present.
+int find_loop(const loop_nest_t* nest, enum Loop loop);
+
+// Number of channels in each tile of the given dimension (IN_CHANNELS or
+// OUT_CHANNELS, or their `*_TILES` loops). This is the whole dimension (within
+// one group) if it isn't tiled.
+uint32_t channel_tile_size(const loop_nest_t* nest, enum Loop dimension,
+                           const conv_shape_t* params);
+
+// Size of a convolution's output (in pixels), including any padding.
+static inline uint conv_output_height(const conv_shape_t* params) {
+  return output_size(params->image_height + 2 * params->padding_h,
+                     params->filter_height, params->stride, params->dilation);
+}
+
+static inline uint conv_output_width(const conv_shape_t* params) {
+  return output_size(params->image_width + 2 * params->padding_w,
+                     params->filter_width, params->stride, params->dilation);
+}
+
+// Number of groups in a convolution. Treats 0 as the default of 1.
+static inline uint32_t conv_groups(const conv_shape_t* params) {
+  return (params->groups == 0) ? 1 : params->groups;
+}
+
+static inline uint32_t in_channels_per_group(const conv_shape_t* params) {
+  return params->in_channels / conv_groups(params);
+}
+
+static inline uint32_t out_channels_per_group(const conv_shape_t* params) {
+  return params->out_channels / conv_groups(params);
+}
+
+// Number of multiply-accumulates in a convolution, including those with
+// padding.
+static inline uint64_t conv_macs(const conv_shape_t* params) {
+  return (uint64_t)params->batch_size * params->out_channels *
+         conv_output_height(params) * conv_output_width(params) *
+         in_channels_per_group(params) * params->filter_height *
+         params->filter_width;
+}
+
+// Whether a GROUPS loop must be added to the nest to compute this convolution.
+int needs_group_loop(const loop_nest_t* nest, const conv_shape_t* params);
+
+// Number of accelerator loops needed to compute this convolution with the
+// given nest.
+static inline uint conv_loop_count(const loop_nest_t* nest,
+                                   const conv_shape_t* params) {
+  return nest->loop_count + needs_group_loop(nest, params);
+}
+
+// Number of iterations of the given loop when computing a convolution with
+// the given loop nest. For tiled dimensions, this includes any partial tile.
+uint32_t loop_iteration_count(const loop_nest_t* nest, enum Loop loop,
+                              const conv_shape_t* params);
+
+// Encode a linear layer as a convolution.
+void linear_shape(conv_shape_t* conv, uint32_t batch_size, uint32_t num_inputs,
+                  uint32_t num_outputs);
+
+// How one dimension of a computation is split into tiles.
+typedef struct {
+  int      tiles_loop;  // Position of `*_TILES` loop in nest, or -1
+  int      inner_loop;  // Position of loop within each tile, or -1
+  uint32_t tile;        // Size of each full tile
+  uint32_t full_tiles;  // Number of full tiles
+  uint32_t remainder;   // Size of partial tile at the end (may be 0)
+
+  // Distance (in bytes) between channels of each operand in this dimension.
+  int32_t  in1_stride;
+  int32_t  in2_stride;
+  int32_t  out_stride;
+} tiling_t;
+
+// How one spatial dimension of a convolution is split into regions which do
+// and don't overlap padding.
+typedef struct {
+  int      image_loop;  // Position of IMAGE_* loop in nest, or -1
+  int      filter_loop; // Position of FILTER_*_OS loop in nest, or -1
+  uint32_t input_size;
+  uint32_t filter_size;
+  uint32_t stride;
+  uint32_t dilation;
+  uint32_t padding;
+  uint32_t edge_before; // Output positions overlapping padding at the start
+  uint32_t interior;    // Output positions not overlapping padding
+  uint32_t edge_after;  // Output positions overlapping padding at the end
+
+  // Distance (in bytes) between positions of each operand in this dimension.
+  int32_t  in1_stride;
+  int32_t  in2_stride;
+  int32_t  out_stride;
+} padding_t;
+
+// Contents of a `lat_handle_t`.
+typedef struct {
+  lat_parameters_t  params;
+  loop_iteration_t  loops[LAT_MAX_ASYNC_LOOPS];
+  uint32_t          iteration_counts[LAT_MAX_ASYNC_LOOPS];
+
+  // Base addresses, before any tiling adjustments.
+  memory_location_t in1;
+  memory_location_t in2;
+  memory_location_t out;
+
+  // A computation may need several accelerator launches if tiles don't divide
+  // the dimensions exactly, or if there is padding.
+  tiling_t          in_tiles;
+  tiling_t          out_tiles;
+  padding_t         rows;
+  padding_t         columns;
+  uint32_t          next_part;
+  int               busy;
+
+  // The part currently being computed, with its loops simplified. Points into
+  // this handle.
+  lat_parameters_t  launch;
+  loop_iteration_t  launch_loops[LAT_MAX_ASYNC_LOOPS];
+  uint32_t          launch_counts[LAT_MAX_ASYNC_LOOPS];
+
+#ifdef LAT_TRACE
+  uint64_t          trace_start;
+  uint64_t          trace_macs;
+  uint64_t          trace_bytes;
+#endif
+} handle_state_t;
+
+_Static_assert(sizeof(handle_state_t) <= sizeof(lat_handle_t),
+               "LAT_HANDLE_SIZE is too small");
+
+static inline handle_state_t* handle_state(lat_handle_t* handle) {
+  return (handle_state_t*)handle->storage;
+}
+
+// Fill in `handle` so it is ready to launch the given convolution. `loops` and
+// `iteration_counts` must have space for `conv_loop_count` loops, and must
+// remain valid until the computation completes.
+//
+// Grouped convolutions need a GROUPS loop. If the nest doesn't have one, it is
+// added as the outermost loop.
+void conv_prepare(
+  handle_state_t* handle,
+  loop_iteration_t* loops,
+  uint32_t* iteration_counts,
+  const activation_config_t* input,
+  const filter_config_t* weights,
+  activation_config_t* output,
+  const conv_shape_t* params,
+  const loop_nest_t* loop_order
+);
+
+// Send the next part of the computation to the accelerator. Returns 0 if
+// there was nothing left to launch.
+int launch_next(handle_state_t* handle);
+
+// Launch a single accelerator computation, with its loops simplified as in
+// `launch_next`, and wait for it to finish.
+void accelerate_and_wait(const lat_parameters_t* params);
+
+// Number of cores which CPU-side work may use (see `lat_set_cpu_cores`).
+uint32_t get_cpu_cores(void);
+
+// Shapes of layers computed on 4D `lat_tensor_t`s. Checks that the output has
+// the expected size.
+conv_shape_t conv_shape_from_tensors(const lat_tensor_t* input,
+                                     const lat_tensor_t* weights,
+                                     const lat_tensor_t* output,
+                                     const conv_options_t* options);
+pool_shape_t pool_shape_from_tensors(const lat_tensor_t* input,
+                                     const lat_tensor_t* output,
+                                     uint32_t window_height,
+                                     uint32_t window_width, uint32_t stride);
+
+// Allocate memory from `arena`, or using `loki_malloc` if `arena` is NULL.
+void* allocate(lat_arena_t* arena, size_t bytes);
+
+// Set strides for the default dimension order: [batch, channels, height,
+// width].
+void set_default_strides(activation_config_t* tensor, uint channels,
+                         uint height, uint width);
+
+// Allocate an activation tensor with the default dimension order, from `arena`
+// if it is not NULL (see `allocate`).
+activation_config_t* init_activation_tensor(uint batch, uint channels,
+                                            uint height, uint width,
+                                            lat_arena_t* arena);
+
+// Set values in memory to 0. Useful for anything which accumulates results in
+// memory, e.g. convolutions. Not necessary for functions which write the result
+// directly, e.g. pooling.
+// Warning: overwrites output channel 2 (as allowed by the ABI).
+void clear_memory(data_t* address, size_t num_words, int memory_config);
+
+// Clear images [first_image, first_image+images) and channels
+// [first_channel, first_channel+channels) of an activation tensor, using as
+// few contiguous ranges as its strides allow.
+void clear_activations(const activation_config_t* tensor, uint first_image,
+                       uint images, uint first_channel, uint channels,
+                       uint height, uint width);
+
+// Convolution computed in chunks (see `lat_conv2d_fused`). If `epilogue` is
+// not NULL, it is applied to each chunk; otherwise the whole layer is one
+// chunk. If `overwrite` is set, each chunk of the output is cleared first (see
+// `lat_conv2d_overwrite`).
+void conv_chunked(
+  const activation_config_t* input,
+  const filter_config_t* weights,
+  activation_config_t* output,
+  const conv_shape_t* params,
+  const loop_nest_t* loop_order,
+  const epilogue_t* epilogue,
+  int overwrite
+);
+
+// Fixed-point reciprocal, so values can be divided by a constant without a
+// division instruction (Loki doesn't have a division unit). Exact for any
+// dividend magnitude below 2^31.
+typedef struct {
+  uint32_t multiplier;
+  uint32_t shift;
+} reciprocal_t;
+
+static inline reciprocal_t make_reciprocal(uint32_t divisor) {
+  uint32_t log = 0;
+  while ((1u << log) < divisor)
+    log++;
+
+  reciprocal_t r;
+  r.shift = 31 + log;
+  r.multiplier = (((uint64_t)1 << r.shift) + divisor - 1) / divisor;
+  return r;
+}
+
+// Integer division, rounding towards zero (as `/` does).
+static inline data_t divide(data_t value, const reciprocal_t* r) {
+  uint32_t magnitude = (value < 0) ? -(uint32_t)value : (uint32_t)value;
+  uint32_t quotient = ((uint64_t)magnitude * r->multiplier) >> r->shift;
+  return (value < 0) ? -(data_t)quotient : (data_t)quotient;
+}
+
+// Move a memory location by the given number of bytes.
+static inline memory_location_t offset_location(memory_location_t location,
+                                                int32_t offset) {
+  location.address = (void*)((char*)location.address + offset);
+  return location;
+}
+
+// Tracing hooks (see nn/trace.h). Wrap an event with
+//   TRACE_BEGIN(start);
+//   ...
+//   TRACE_END(start, TRACE_SETUP, macs, bytes);
+// `macs` and `bytes` are only evaluated while tracing is enabled. Without
+// `LAT_TRACE`, the hooks compile to nothing.
+#ifdef LAT_TRACE
+extern int trace_enabled;
+uint64_t trace_time(void);
+void trace_record(enum TraceEvent event, uint64_t start, uint64_t macs,
+                  uint64_t bytes);
+
+#define TRACE_BEGIN(start) uint64_t start = trace_enabled ? trace_time() : 0
+#define TRACE_END(start, event, macs, bytes) \
+  do { \
+    if (trace_enabled) \
+      trace_record(event, start, macs, bytes); \
+  } while (0)
+#else
+#define TRACE_BEGIN(start)
+#define TRACE_END(start, event, macs, bytes)
+#endif
+
+#endif // include guard
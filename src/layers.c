@@ -6,319 +6,847 @@
 #include <loki/channel_io.h>
 #include <loki/ids.h>
 #include "nn/layers.h"
+#include "nn/tuning.h"
+#include "internal.h"
 
-// Determine how large the output will be (in pixels), given the computation
-// parameters. This applies to any windowed computation, e.g. convolution,
-// pooling.
-// The equation is taken from PyTorch (minus the `padding` parameter):
-// https://pytorch.org/docs/stable/nn.html#conv2d
 uint output_size(uint input_size, uint window_size, uint stride, uint dilation) {
   int size = ((input_size - dilation * (window_size - 1) - 1) / stride) + 1;
   return (size < 0) ? 0 : size;
 }
 
-void lat_conv2d(
+int find_loop(const loop_nest_t* nest, enum Loop loop) {
+  for (uint i=0; i<nest->loop_count; i++)
+    if (nest->loops[i] == loop)
+      return i;
+
+  return -1;
+}
+
+uint32_t channel_tile_size(const loop_nest_t* nest, enum Loop dimension,
+                           const conv_shape_t* params) {
+  uint32_t extent, tile;
+  enum Loop tile_loop;
+
+  if (dimension == IN_CHANNELS || dimension == IN_CHANNEL_TILES) {
+    extent = in_channels_per_group(params);
+    tile = nest->in_channel_tile;
+    tile_loop = IN_CHANNEL_TILES;
+  }
+  else {
+    extent = out_channels_per_group(params);
+    tile = nest->out_channel_tile;
+    tile_loop = OUT_CHANNEL_TILES;
+  }
+
+  if (tile == 0 || tile > extent || find_loop(nest, tile_loop) < 0)
+    return extent;
+  else
+    return tile;
+}
+
+int needs_group_loop(const loop_nest_t* nest, const conv_shape_t* params) {
+  return conv_groups(params) > 1 && find_loop(nest, GROUPS) < 0;
+}
+
+uint32_t loop_iteration_count(const loop_nest_t* nest, enum Loop loop,
+                              const conv_shape_t* params) {
+  switch (loop) {
+    case BATCH:
+      return params->batch_size;
+    case GROUPS:
+      return conv_groups(params);
+    case IN_CHANNELS:
+    case OUT_CHANNELS:
+      return channel_tile_size(nest, loop, params);
+    case IN_CHANNEL_TILES:
+    case OUT_CHANNEL_TILES: {
+      uint32_t extent = (loop == IN_CHANNEL_TILES)
+                      ? in_channels_per_group(params)
+                      : out_channels_per_group(params);
+      uint32_t tile = channel_tile_size(nest, loop, params);
+      return (tile == 0) ? 0 : (extent + tile - 1) / tile;
+    }
+    case IMAGE_WIDTH:
+      return conv_output_width(params);
+    case IMAGE_HEIGHT:
+      return conv_output_height(params);
+    case FILTER_WIDTH_OS:
+    case FILTER_WIDTH_IS:
+      return params->filter_width;
+    case FILTER_HEIGHT_OS:
+    case FILTER_HEIGHT_IS:
+      return params->filter_height;
+    default:
+      printf("Error: unsupported convolution Loop enum: %d\n", loop);
+      exit(1);
+  }
+}
+
+// `first_loop` is the position of the nest's first loop in the accelerator's
+// loops (there may be extra loops before it).
+static tiling_t get_tiling(const loop_nest_t* nest, enum Loop tiles_loop,
+                               enum Loop inner_loop, uint32_t extent,
+                               const conv_shape_t* params, int first_loop) {
+  tiling_t tiling;
+  tiling.tiles_loop = find_loop(nest, tiles_loop);
+  tiling.inner_loop = find_loop(nest, inner_loop);
+  if (tiling.tiles_loop >= 0)
+    tiling.tiles_loop += first_loop;
+  if (tiling.inner_loop >= 0)
+    tiling.inner_loop += first_loop;
+  tiling.tile = channel_tile_size(nest, inner_loop, params);
+
+  if (tiling.tiles_loop < 0 || tiling.tile == 0) {
+    // Untiled: treat as one full tile which needs no adjustment.
+    tiling.full_tiles = 1;
+    tiling.remainder = 0;
+  }
+  else {
+    tiling.full_tiles = extent / tiling.tile;
+    tiling.remainder = extent % tiling.tile;
+  }
+
+  return tiling;
+}
+
+// Set up the loop nest to compute either the full tiles of a dimension
+// (`partial` = 0) or the partial tile at the end (`partial` = 1). Returns the
+// number of channels skipped to reach the partial tile.
+static uint32_t select_tiles(lat_parameters_t* p, const tiling_t* tiling,
+                             int partial) {
+  if (tiling->tiles_loop < 0)
+    return 0;
+
+  p->iteration_counts[tiling->tiles_loop] = partial ? 1 : tiling->full_tiles;
+  if (tiling->inner_loop >= 0)
+    p->iteration_counts[tiling->inner_loop] =
+        partial ? tiling->remainder : tiling->tile;
+
+  return partial ? tiling->full_tiles * tiling->tile : 0;
+}
+
+static padding_t get_padding(const loop_nest_t* nest, enum Loop image_loop,
+                                 enum Loop filter_loop, uint32_t input_size,
+                                 uint32_t filter_size, uint32_t padding,
+                                 uint32_t output_size,
+                                 const conv_shape_t* params, int first_loop) {
+  padding_t pad;
+  pad.image_loop = find_loop(nest, image_loop);
+  pad.filter_loop = find_loop(nest, filter_loop);
+  if (pad.image_loop >= 0)
+    pad.image_loop += first_loop;
+  if (pad.filter_loop >= 0)
+    pad.filter_loop += first_loop;
+
+  pad.input_size = input_size;
+  pad.filter_size = filter_size;
+  pad.stride = params->stride;
+  pad.dilation = params->dilation;
+  pad.padding = padding;
+
+  // Output positions [first_inside, end_inside) have windows entirely inside
+  // the input.
+  uint32_t first_inside = (padding + params->stride - 1) / params->stride;
+  if (first_inside > output_size)
+    first_inside = output_size;
+
+  int32_t last_start = (int32_t)input_size - 1 + padding -
+                       params->dilation * (filter_size - 1);
+  uint32_t end_inside = first_inside;
+  if (last_start >= 0 && last_start / params->stride + 1 > first_inside)
+    end_inside = last_start / params->stride + 1;
+  if (end_inside > output_size)
+    end_inside = output_size;
+
+  pad.edge_before = first_inside;
+  pad.interior = end_inside - first_inside;
+  pad.edge_after = output_size - end_inside;
+
+  return pad;
+}
+
+static uint32_t num_regions(const padding_t* pad) {
+  return pad->edge_before + ((pad->interior > 0) ? 1 : 0) + pad->edge_after;
+}
+
+// Set up the loop nest to compute one region of a spatial dimension: either
+// one output position whose window overlaps the padding, or all positions
+// whose windows don't. Edge positions use only the part of the filter which
+// overlaps the input, so padding never needs to be stored.
+// Returns 0 if the region needs no computation, or 1 and the distance (in
+// positions) to move each operand.
+static int select_region(lat_parameters_t* p, const padding_t* pad,
+                         uint32_t region, int32_t* input_skip,
+                         uint32_t* filter_skip, uint32_t* output_skip) {
+  uint32_t has_interior = (pad->interior > 0) ? 1 : 0;
+  uint32_t first, count;
+
+  if (region < pad->edge_before) {
+    first = region;
+    count = 1;
+  }
+  else if (region < pad->edge_before + has_interior) {
+    first = pad->edge_before;
+    count = pad->interior;
+  }
+  else {
+    first = pad->interior + region - has_interior;
+    count = 1;
+  }
+
+  // Input position (possibly in the padding) of the first filter element.
+  int32_t start = first * pad->stride - pad->padding;
+
+  // Range of filter elements which land inside the input.
+  uint32_t filter_first = 0;
+  if (start < 0)
+    filter_first = (-start + pad->dilation - 1) / pad->dilation;
+
+  int32_t last = (int32_t)pad->input_size - 1 - start;
+  uint32_t filter_end = 0;
+  if (last >= 0)
+    filter_end = last / pad->dilation + 1;
+  if (filter_end > pad->filter_size)
+    filter_end = pad->filter_size;
+
+  if (filter_end <= filter_first)
+    return 0;
+
+  if (pad->image_loop >= 0)
+    p->iteration_counts[pad->image_loop] = count;
+  if (pad->filter_loop >= 0)
+    p->iteration_counts[pad->filter_loop] = filter_end - filter_first;
+
+  *input_skip = start + filter_first * pad->dilation;
+  *filter_skip = filter_first;
+  *output_skip = first;
+
+  return 1;
+}
+
+void conv_prepare(
+  handle_state_t* handle,
+  loop_iteration_t* loops,
+  uint32_t* iteration_counts,
   const activation_config_t* input,
   const filter_config_t* weights,
   activation_config_t* output,
   const conv_shape_t* params,
   const loop_nest_t* loop_order
 ) {
+  TRACE_BEGIN(start);
+  lat_parameters_t* p = &handle->params;
 
-  // TODO: provide a default loop order if none is provided.
-  assert(loop_order != NULL);
+  uint32_t this_core = single_core_bitmask(get_core_id());
+  p->notification_address = loki_mcast_address(this_core, CH_REGISTER_3, 0);
 
-  // Memory allocation is not multi-tile safe, so use statically allocated
-  // arrays.
-  assert(loop_order->loop_count <= 10);
-  loop_iteration_t loops[10];
-  uint32_t iteration_counts[10];
+  int first_loop = needs_group_loop(loop_order, params);
 
-  lat_parameters_t p;
+  p->loop_count = conv_loop_count(loop_order, params);
+  p->loops = loops;
+  p->iteration_counts = iteration_counts;
 
-  uint32_t this_core = single_core_bitmask(get_core_id());
-  p.notification_address = loki_mcast_address(this_core, CH_REGISTER_3, 0);
-
-  p.loop_count = loop_order->loop_count;
-  p.loops = loops;
-  p.iteration_counts = iteration_counts;
+  uint32_t in_tile = channel_tile_size(loop_order, IN_CHANNELS, params);
+  uint32_t out_tile = channel_tile_size(loop_order, OUT_CHANNELS, params);
 
   // Default: in1=input, in2=weights, out=output.
-  for (uint i=0; i<p.loop_count; i++) {
-    switch (loop_order->loops[i]) {
+  for (uint i=0; i<p->loop_count; i++) {
+    enum Loop loop = (i < first_loop) ? GROUPS
+                                      : loop_order->loops[i - first_loop];
+
+    switch (loop) {
       case BATCH:
-        p.loops[i].in1_stride = input->batch_stride;
-        p.loops[i].in2_stride = 0;
-        p.loops[i].out_stride = output->batch_stride;
-        p.iteration_counts[i] = params->batch_size;
+        p->loops[i].in1_stride = input->batch_stride;
+        p->loops[i].in2_stride = 0;
+        p->loops[i].out_stride = output->batch_stride;
         break;
 
       case IN_CHANNELS:
-        p.loops[i].in1_stride = input->channel_stride;
-        p.loops[i].in2_stride = weights->in_channel_stride;
-        p.loops[i].out_stride = 0;
-        p.iteration_counts[i] = params->in_channels;
+        p->loops[i].in1_stride = input->channel_stride;
+        p->loops[i].in2_stride = weights->in_channel_stride;
+        p->loops[i].out_stride = 0;
         break;
 
       case OUT_CHANNELS:
-        p.loops[i].in1_stride = 0;
-        p.loops[i].in2_stride = weights->out_channel_stride;
-        p.loops[i].out_stride = output->channel_stride;
-        p.iteration_counts[i] = params->out_channels;
+        p->loops[i].in1_stride = 0;
+        p->loops[i].in2_stride = weights->out_channel_stride;
+        p->loops[i].out_stride = output->channel_stride;
         break;
 
       case IMAGE_WIDTH:
-        p.loops[i].in1_stride = input->column_stride * params->stride;
-        p.loops[i].in2_stride = 0;
-        p.loops[i].out_stride = output->column_stride;
-        p.iteration_counts[i] = output_size(params->image_width,
-            params->filter_width, params->stride, params->dilation);
+        p->loops[i].in1_stride = input->column_stride * params->stride;
+        p->loops[i].in2_stride = 0;
+        p->loops[i].out_stride = output->column_stride;
         break;
 
       case IMAGE_HEIGHT:
-        p.loops[i].in1_stride = input->row_stride * params->stride;
-        p.loops[i].in2_stride = 0;
-        p.loops[i].out_stride = output->row_stride;
-        p.iteration_counts[i] = output_size(params->image_height,
-            params->filter_height, params->stride, params->dilation);
+        p->loops[i].in1_stride = input->row_stride * params->stride;
+        p->loops[i].in2_stride = 0;
+        p->loops[i].out_stride = output->row_stride;
         break;
 
       case FILTER_WIDTH_OS:
-        p.loops[i].in1_stride = input->column_stride * params->dilation;
-        p.loops[i].in2_stride = weights->column_stride;
-        p.loops[i].out_stride = 0;
-        p.iteration_counts[i] = params->filter_width;
+        p->loops[i].in1_stride = input->column_stride * params->dilation;
+        p->loops[i].in2_stride = weights->column_stride;
+        p->loops[i].out_stride = 0;
         break;
 
       case FILTER_HEIGHT_OS:
-        p.loops[i].in1_stride = input->row_stride * params->dilation;
-        p.loops[i].in2_stride = weights->row_stride;
-        p.loops[i].out_stride = 0;
-        p.iteration_counts[i] = params->filter_height;
+        p->loops[i].in1_stride = input->row_stride * params->dilation;
+        p->loops[i].in2_stride = weights->row_stride;
+        p->loops[i].out_stride = 0;
         break;
 
       case FILTER_WIDTH_IS:
-        p.loops[i].in1_stride = 0;
-        p.loops[i].in2_stride = weights->column_stride;
-        p.loops[i].out_stride = -output->column_stride * params->dilation;
-        p.iteration_counts[i] = params->filter_width;
+        p->loops[i].in1_stride = 0;
+        p->loops[i].in2_stride = weights->column_stride;
+        p->loops[i].out_stride = -output->column_stride * params->dilation;
         break;
 
       case FILTER_HEIGHT_IS:
-        p.loops[i].in1_stride = 0;
-        p.loops[i].in2_stride = weights->row_stride;
-        p.loops[i].out_stride = -output->row_stride * params->dilation;
-        p.iteration_counts[i] = params->filter_height;
+        p->loops[i].in1_stride = 0;
+        p->loops[i].in2_stride = weights->row_stride;
+        p->loops[i].out_stride = -output->row_stride * params->dilation;
+        break;
+
+      case GROUPS:
+        p->loops[i].in1_stride =
+            input->channel_stride * in_channels_per_group(params);
+        p->loops[i].in2_stride = weights->group_stride;
+        p->loops[i].out_stride =
+            output->channel_stride * out_channels_per_group(params);
+        break;
+
+      case IN_CHANNEL_TILES:
+        p->loops[i].in1_stride = input->channel_stride * in_tile;
+        p->loops[i].in2_stride = weights->in_channel_stride * in_tile;
+        p->loops[i].out_stride = 0;
+        break;
+
+      case OUT_CHANNEL_TILES:
+        p->loops[i].in1_stride = 0;
+        p->loops[i].in2_stride = weights->out_channel_stride * out_tile;
+        p->loops[i].out_stride = output->channel_stride * out_tile;
         break;
 
       default:
-        printf("Error: unsupported convolution Loop enum: %d\n",
-               loop_order->loops[i]);
+        printf("Error: unsupported convolution Loop enum: %d\n", loop);
         exit(1);
         break;
     }
+
+    p->iteration_counts[i] = loop_iteration_count(loop_order, loop, params);
   }
 
-  p.in1 = input->data;
-  p.in2 = weights->data;
-  p.out = output->data;
+  handle->in1 = input->data;
+  handle->in2 = weights->data;
+  handle->out = output->data;
+
+  handle->in_tiles = get_tiling(loop_order, IN_CHANNEL_TILES, IN_CHANNELS,
+                                in_channels_per_group(params), params,
+                                first_loop);
+  handle->in_tiles.in1_stride = input->channel_stride;
+  handle->in_tiles.in2_stride = weights->in_channel_stride;
+  handle->in_tiles.out_stride = 0;
+
+  handle->out_tiles = get_tiling(loop_order, OUT_CHANNEL_TILES, OUT_CHANNELS,
+                                 out_channels_per_group(params), params,
+                                 first_loop);
+  handle->out_tiles.in1_stride = 0;
+  handle->out_tiles.in2_stride = weights->out_channel_stride;
+  handle->out_tiles.out_stride = output->channel_stride;
+
+  if ((params->padding_h > 0 || params->padding_w > 0) &&
+      (find_loop(loop_order, FILTER_WIDTH_IS) >= 0 ||
+       find_loop(loop_order, FILTER_HEIGHT_IS) >= 0)) {
+    printf("Error: padding is not supported with input stationary loops\n");
+    exit(1);
+  }
 
-  lat_accelerate(&p);
-  // Could do something else while waiting. (But need to put `p` on the heap.)
-  // Or could notify a different core, in a software pipeline sort of way.
-  lat_sync(&p);
+  handle->rows = get_padding(loop_order, IMAGE_HEIGHT, FILTER_HEIGHT_OS,
+                             params->image_height, params->filter_height,
+                             params->padding_h, conv_output_height(params),
+                             params, first_loop);
+  handle->rows.in1_stride = input->row_stride;
+  handle->rows.in2_stride = weights->row_stride;
+  handle->rows.out_stride = output->row_stride;
+
+  handle->columns = get_padding(loop_order, IMAGE_WIDTH, FILTER_WIDTH_OS,
+                                params->image_width, params->filter_width,
+                                params->padding_w, conv_output_width(params),
+                                params, first_loop);
+  handle->columns.in1_stride = input->column_stride;
+  handle->columns.in2_stride = weights->column_stride;
+  handle->columns.out_stride = output->column_stride;
+
+  handle->next_part = 0;
+  handle->busy = 0;
+
+#ifdef LAT_TRACE
+  handle->trace_macs = conv_macs(params);
+  handle->trace_bytes = lat_loop_nest_traffic(params, loop_order);
+#endif
+
+  TRACE_END(start, TRACE_SETUP, 0, 0);
+}
 
+// Loops whose position doesn't change any operand's address, or changes it
+// the same way. Interchanging two loops of the same class keeps the same
+// operands stationary.
+static inline int loop_class(const loop_iteration_t* loop) {
+  return (loop->in1_stride == 0) | ((loop->in2_stride == 0) << 1) |
+         ((loop->out_stride == 0) << 2);
 }
 
-void lat_linear(
+// Whether `outer` steps each operand over exactly the range covered by
+// `inner`, so the two can be replaced by a single loop.
+static inline int can_fuse(const loop_iteration_t* outer,
+                           const loop_iteration_t* inner,
+                           uint32_t inner_count) {
+  return (int64_t)outer->in1_stride == (int64_t)inner->in1_stride*inner_count &&
+         (int64_t)outer->in2_stride == (int64_t)inner->in2_stride*inner_count &&
+         (int64_t)outer->out_stride == (int64_t)inner->out_stride*inner_count;
+}
+
+// Merge each adjacent pair of loops which can be fused. Returns the new number
+// of loops.
+static uint32_t fuse_loops(loop_iteration_t* loops, uint32_t* counts,
+                           uint32_t loop_count) {
+  uint32_t fused = 0;
+
+  for (uint i=0; i<loop_count; i++) {
+    loop_iteration_t loop = loops[i];
+    uint32_t count = counts[i];
+
+    // The merged loop may in turn fuse with the one outside it.
+    while (fused > 0 && can_fuse(&loops[fused-1], &loop, count) &&
+           (uint64_t)counts[fused-1] * count <= UINT32_MAX) {
+      count *= counts[fused-1];
+      fused--;
+    }
+
+    loops[fused] = loop;
+    counts[fused] = count;
+    fused++;
+  }
+
+  return fused;
+}
+
+// Copy `p`'s loops into `launch`, simplified without changing the
+// computation:
+//  * Loops with one iteration are removed. e.g. linear layers have no use for
+//    the image and filter loops.
+//  * Adjacent loops which step through memory contiguously are fused. e.g.
+//    image rows and columns of a 1x1 convolution.
+//  * The innermost loops which keep the same operands stationary are sorted
+//    so the longest is innermost. The nest's dataflow is preserved, but the
+//    accelerator's columns are better used.
+// Every point of the iteration space is independent, so this only changes
+// the order of accumulation.
+static void simplify_loops(const lat_parameters_t* p, lat_parameters_t* launch,
+                           loop_iteration_t* loops, uint32_t* counts) {
+  *launch = *p;
+
+  uint32_t loop_count = 0;
+  for (uint i=0; i<p->loop_count; i++) {
+    // An empty loop means nothing is computed. Leave it to the accelerator.
+    if (p->iteration_counts[i] == 0)
+      return;
+
+    if (p->iteration_counts[i] != 1) {
+      loops[loop_count] = p->loops[i];
+      counts[loop_count] = p->iteration_counts[i];
+      loop_count++;
+    }
+  }
+
+  loop_count = fuse_loops(loops, counts, loop_count);
+
+  if (loop_count > 1) {
+    int cls = loop_class(&loops[loop_count-1]);
+    uint first = loop_count - 1;
+    while (first > 0 && loop_class(&loops[first-1]) == cls)
+      first--;
+
+    // Insertion sort: stable, and there are only a few loops.
+    for (uint i=first+1; i<loop_count; i++) {
+      loop_iteration_t loop = loops[i];
+      uint32_t count = counts[i];
+      uint j = i;
+      for (; j>first && counts[j-1] > count; j--) {
+        loops[j] = loops[j-1];
+        counts[j] = counts[j-1];
+      }
+      loops[j] = loop;
+      counts[j] = count;
+    }
+
+    loop_count = fuse_loops(loops, counts, loop_count);
+  }
+
+  // Always give the accelerator at least one loop.
+  if (loop_count == 0) {
+    loops[0].in1_stride = 0;
+    loops[0].in2_stride = 0;
+    loops[0].out_stride = 0;
+    counts[0] = 1;
+    loop_count = 1;
+  }
+
+  launch->loop_count = loop_count;
+  launch->loops = loops;
+  launch->iteration_counts = counts;
+}
+
+void accelerate_and_wait(const lat_parameters_t* p) {
+  lat_parameters_t launch;
+  loop_iteration_t loops[p->loop_count + 1];
+  uint32_t counts[p->loop_count + 1];
+  simplify_loops(p, &launch, loops, counts);
+
+  TRACE_BEGIN(start);
+  lat_accelerate(&launch);
+  TRACE_END(start, TRACE_ACCELERATE, 0, 0);
+
+  TRACE_BEGIN(sync_start);
+  lat_sync(&launch);
+  TRACE_END(sync_start, TRACE_SYNC, 0, 0);
+}
+
+// All iterations of an accelerator loop must have the same length, so some
+// computations are split into several launches:
+//  * If a tiled dimension isn't a multiple of the tile size, the partial tile
+//    at the end is computed separately. There are up to four combinations of
+//    full/partial input tiles and full/partial output tiles.
+//  * If there is padding, each output row/column which overlaps it is computed
+//    separately, with a shorter filter loop.
+int launch_next(handle_state_t* handle) {
+  lat_parameters_t* p = &handle->params;
+  const tiling_t* in_tiles = &handle->in_tiles;
+  const tiling_t* out_tiles = &handle->out_tiles;
+  const padding_t* rows = &handle->rows;
+  const padding_t* columns = &handle->columns;
+
+  uint32_t row_regions = num_regions(rows);
+  uint32_t parts = 4 * row_regions * num_regions(columns);
+
+  // The whole layer is traced from its first launch until nothing is left.
+#ifdef LAT_TRACE
+  if (handle->next_part == 0)
+    handle->trace_start = trace_enabled ? trace_time() : 0;
+#endif
+
+  for (; handle->next_part < parts; handle->next_part++) {
+    uint32_t tile_part = handle->next_part % 4;
+    uint32_t region = handle->next_part / 4;
+
+    int in_partial = tile_part >> 1;
+    int out_partial = tile_part & 1;
+
+    if ((in_partial ? in_tiles->remainder : in_tiles->full_tiles) == 0)
+      continue;
+    if ((out_partial ? out_tiles->remainder : out_tiles->full_tiles) == 0)
+      continue;
+
+    int32_t row_in, col_in;
+    uint32_t row_filter, col_filter, row_out, col_out;
+    if (!select_region(p, rows, region % row_regions,
+                       &row_in, &row_filter, &row_out))
+      continue;
+    if (!select_region(p, columns, region / row_regions,
+                       &col_in, &col_filter, &col_out))
+      continue;
+
+    uint32_t in_skip = select_tiles(p, in_tiles, in_partial);
+    uint32_t out_skip = select_tiles(p, out_tiles, out_partial);
+
+    p->in1 = offset_location(handle->in1, in_skip * in_tiles->in1_stride +
+                                          row_in * rows->in1_stride +
+                                          col_in * columns->in1_stride);
+    p->in2 = offset_location(handle->in2, in_skip * in_tiles->in2_stride +
+                                          out_skip * out_tiles->in2_stride +
+                                          row_filter * rows->in2_stride +
+                                          col_filter * columns->in2_stride);
+    p->out = offset_location(handle->out, out_skip * out_tiles->out_stride +
+                                          row_out * rows->out_stride +
+                                          col_out * columns->out_stride);
+
+    // Nests too long for the handle (only possible with `lat_conv2d`) are
+    // launched as they are.
+    const lat_parameters_t* launch = p;
+    if (p->loop_count <= LAT_MAX_ASYNC_LOOPS) {
+      simplify_loops(p, &handle->launch, handle->launch_loops,
+                     handle->launch_counts);
+      launch = &handle->launch;
+    }
+
+    TRACE_BEGIN(start);
+    lat_accelerate(launch);
+    TRACE_END(start, TRACE_ACCELERATE, 0, 0);
+
+    handle->busy = 1;
+    handle->next_part++;
+    return 1;
+  }
+
+  TRACE_END(handle->trace_start, TRACE_CONV2D, handle->trace_macs,
+            handle->trace_bytes);
+  return 0;
+}
+
+lat_handle_t* lat_conv2d_async(
   const activation_config_t* input,
   const filter_config_t* weights,
   activation_config_t* output,
-  uint32_t batch_size,
-  uint32_t num_inputs,
-  uint32_t num_outputs,
-  const loop_nest_t* loop_order
+  const conv_shape_t* params,
+  const loop_nest_t* loop_order,
+  lat_handle_t* handle
 ) {
-  // TODO: the accelerator interface is currently limited to convolutions.
-  // Simplify this when the interface is generalised.
+  if (loop_order == NULL)
+    loop_order = lat_choose_loop_nest(params);
 
-  // Encode this layer as a convolution.
-  conv_shape_t conv;
-  conv.batch_size = batch_size;
-  conv.in_channels = num_inputs;
-  conv.out_channels = num_outputs;
-  conv.image_width = 1;
-  conv.image_height = 1;
-  conv.filter_width = 1;
-  conv.filter_height = 1;
-  conv.groups = 1;
-  conv.stride = 1;
-  conv.dilation = 1;
+  assert(conv_loop_count(loop_order, params) <= LAT_MAX_ASYNC_LOOPS);
 
-  lat_conv2d(input, weights, output, &conv, loop_order);
-}
+  handle_state_t* state = handle_state(handle);
+  conv_prepare(state, state->loops, state->iteration_counts, input, weights,
+               output, params, loop_order);
+  launch_next(state);
 
+  return handle;
+}
 
-// This is for one window.
-data_t window_max(data_t* data, int num_cols, int col_step, int num_rows,
-                  int row_step) {
-  data_t max = *data;
+int lat_poll(lat_handle_t* opaque) {
+  handle_state_t* handle = handle_state(opaque);
 
-  for (int row=0; row<num_rows; row++) {
-    data_t* data_ptr = data + (row * row_step);
+  while (handle->busy) {
+    // The accelerator sends a notification when it finishes. Consume it and
+    // start the next part, if there is one.
+    if (!test_channel(CH_REGISTER_3))
+      return 0;
 
-    for (int col=0; col<num_cols; col++) {
-      if (*data_ptr > max)
-        max = *data_ptr;
+    TRACE_BEGIN(start);
+    lat_sync(&handle->params);
+    TRACE_END(start, TRACE_SYNC, 0, 0);
 
-      data_ptr += col_step;
-    }
+    handle->busy = 0;
+    launch_next(handle);
   }
 
-  return max;
+  return 1;
 }
 
-// This is for one window.
-data_t window_avg(data_t* data, int num_cols, int col_step, int num_rows,
-                  int row_step) {
-  data_t sum = 0;
+void lat_wait(lat_handle_t* opaque) {
+  handle_state_t* handle = handle_state(opaque);
 
-  for (int row=0; row<num_rows; row++) {
-    data_t* data_ptr = data + (row * row_step);
+  while (handle->busy) {
+    TRACE_BEGIN(start);
+    lat_sync(&handle->params);
+    TRACE_END(start, TRACE_SYNC, 0, 0);
 
-    for (int col=0; col<num_cols; col++) {
-      sum += *data_ptr;
-      data_ptr += col_step;
-    }
+    handle->busy = 0;
+    launch_next(handle);
   }
+}
+
+void lat_conv2d(
+  const activation_config_t* input,
+  const filter_config_t* weights,
+  activation_config_t* output,
+  const conv_shape_t* params,
+  const loop_nest_t* loop_order
+) {
+  if (loop_order == NULL)
+    loop_order = lat_choose_loop_nest(params);
+
+  // Memory allocation is not multi-tile safe, so put arrays on the stack.
+  // These may be larger than the handle allows.
+  uint loop_count = conv_loop_count(loop_order, params);
+  loop_iteration_t loops[loop_count];
+  uint32_t iteration_counts[loop_count];
+
+  lat_handle_t handle;
+  conv_prepare(handle_state(&handle), loops, iteration_counts, input, weights,
+               output, params, loop_order);
+  launch_next(handle_state(&handle));
+  lat_wait(&handle);
+}
 
-  // Note that Loki doesn't have a division unit, so this is especially slow.
-  return sum / (num_cols * num_rows);
+activation_config_t lat_activation_slice(const activation_config_t* tensor,
+                                         uint32_t first_image,
+                                         uint32_t first_channel,
+                                         uint32_t first_row,
+                                         uint32_t first_column) {
+  activation_config_t slice = *tensor;
+  slice.data = offset_location(tensor->data,
+                               first_image * tensor->batch_stride +
+                               first_channel * tensor->channel_stride +
+                               first_row * tensor->row_stride +
+                               first_column * tensor->column_stride);
+  return slice;
 }
 
-void lat_max_pool_2d(
+void linear_shape(conv_shape_t* conv, uint32_t batch_size,
+                  uint32_t num_inputs, uint32_t num_outputs) {
+  // TODO: the accelerator interface is currently limited to convolutions.
+  // Simplify this when the interface is generalised.
+  conv->batch_size = batch_size;
+  conv->in_channels = num_inputs;
+  conv->out_channels = num_outputs;
+  conv->image_width = 1;
+  conv->image_height = 1;
+  conv->filter_width = 1;
+  conv->filter_height = 1;
+  conv->groups = 1;
+  conv->stride = 1;
+  conv->dilation = 1;
+  conv->padding_h = 0;
+  conv->padding_w = 0;
+}
+
+void lat_linear(
   const activation_config_t* input,
+  const filter_config_t* weights,
   activation_config_t* output,
-  const pool_shape_t* params
+  uint32_t batch_size,
+  uint32_t num_inputs,
+  uint32_t num_outputs,
+  const loop_nest_t* loop_order
 ) {
-  // TODO: Have a way to turn warnings off.
-  fprintf(stderr, "Note: max pool is running on Loki CPU (unoptimised)\n");
-
-  // This is the furthest we can iterate through the input, while still having
-  // space for a full window.
-  // TODO: dilation
-  uint max_height = params->input_height - params->window_height + 1;
-  uint max_width = params->input_width - params->window_width + 1;
-
-  for (uint b=0; b<params->batch_size; b++) {
-    for (uint ch=0; ch<params->channels; ch++) {
-      for (uint row=0; row<max_height; row+=params->stride) {
-        for (uint col=0; col<max_width; col+=params->stride) {
-          data_t* in_ptr = input->data.address + (b*input->batch_stride +
-                           ch*input->channel_stride + row*input->row_stride +
-                           col*input->column_stride) / sizeof(data_t);
-          data_t* out_ptr = output->data.address + (b*output->batch_stride +
-                            ch*output->channel_stride + row*output->row_stride +
-                            col*output->column_stride) / sizeof(data_t);
-
-          *out_ptr = window_max(in_ptr, params->window_width,
-                                input->column_stride / sizeof(data_t),
-                                params->window_height,
-                                input->row_stride / sizeof(data_t));
-        }
-      }
-    }
-  }
+  conv_shape_t conv;
+  linear_shape(&conv, batch_size, num_inputs, num_outputs);
+
+  lat_conv2d(input, weights, output, &conv, loop_order);
 }
 
-void lat_avg_pool_2d(
+lat_handle_t* lat_linear_async(
   const activation_config_t* input,
+  const filter_config_t* weights,
   activation_config_t* output,
-  const pool_shape_t* params
+  uint32_t batch_size,
+  uint32_t num_inputs,
+  uint32_t num_outputs,
+  const loop_nest_t* loop_order,
+  lat_handle_t* handle
 ) {
-  // TODO: Have a way to turn warnings off.
-  fprintf(stderr, "Note: avg pool is running on Loki CPU (unoptimised)\n");
-
-  // This is the furthest we can iterate through the input, while still having
-  // space for a full window.
-  // TODO: dilation.
-  uint max_height = params->input_height - params->window_height + 1;
-  uint max_width = params->input_width - params->window_width + 1;
-
-  for (uint b=0; b<params->batch_size; b++) {
-    for (uint ch=0; ch<params->channels; ch++) {
-      for (uint row=0; row<max_height; row+=params->stride) {
-        for (uint col=0; col<max_width; col+=params->stride) {
-          data_t* in_ptr = input->data.address + (b*input->batch_stride +
-                           ch*input->channel_stride + row*input->row_stride +
-                           col*input->column_stride) / sizeof(data_t);
-          data_t* out_ptr = output->data.address + (b*output->batch_stride +
-                            ch*output->channel_stride + row*output->row_stride +
-                            col*output->column_stride) / sizeof(data_t);
-
-          *out_ptr = window_avg(in_ptr, params->window_width,
-                                input->column_stride / sizeof(data_t),
-                                params->window_height,
-                                input->row_stride / sizeof(data_t));
-        }
-      }
-    }
-  }
+  conv_shape_t conv;
+  linear_shape(&conv, batch_size, num_inputs, num_outputs);
+
+  return lat_conv2d_async(input, weights, output, &conv, loop_order, handle);
 }
 
 
+void* allocate(lat_arena_t* arena, size_t bytes) {
+  if (arena == NULL)
+    return loki_malloc(bytes);
+  else
+    return lat_arena_alloc(arena, bytes);
+}
+
+void set_default_strides(activation_config_t* tensor, uint channels,
+                         uint height, uint width) {
+  tensor->column_stride = sizeof(data_t);
+  tensor->row_stride = width * tensor->column_stride;
+  tensor->channel_stride = height * tensor->row_stride;
+  tensor->batch_stride = channels * tensor->channel_stride;
+}
+
 // Allocate and initialise an activation tensor with the given dimensions.
 // The default dimension order is [batch, channels, height, width].
-// The user is responsible for deallocating both the tensor and its data array
-// (`tensor->address`).
+// If `arena` is NULL, the user is responsible for deallocating both the tensor
+// and its data array (`tensor->address`). Otherwise, both are allocated from
+// the arena and use its memory group.
 activation_config_t* init_activation_tensor(uint batch, uint channels,
-                                            uint height, uint width) {
-  activation_config_t* tensor = loki_malloc(sizeof(activation_config_t));
+                                            uint height, uint width,
+                                            lat_arena_t* arena) {
+  activation_config_t* tensor = allocate(arena, sizeof(activation_config_t));
   assert(tensor != NULL);
 
   size_t words = batch * channels * width * height;
   size_t bytes = words * sizeof(data_t);
-  tensor->data.address = loki_malloc(bytes);
+  tensor->data.address = allocate(arena, bytes);
   assert(tensor->data.address != NULL);
 
-  tensor->row_stride = sizeof(data_t);
-  tensor->column_stride = width * tensor->row_stride;
-  tensor->channel_stride = height * tensor->column_stride;
-  tensor->batch_stride = channels * tensor->channel_stride;
+  if (arena != NULL)
+    tensor->data.memory_config = arena->memory_config;
+
+  set_default_strides(tensor, channels, height, width);
 
   return tensor;
 }
 
-// Set values in memory to 0. Useful for anything which accumulates results in
-// memory, e.g. convolutions. Not necessary for functions which write the result
-// directly, e.g. pooling.
-// Warning: overwrites output channel 2 (as allowed by the ABI).
 void clear_memory(data_t* address, size_t num_words, int memory_config) {
+  TRACE_BEGIN(start);
+
   set_channel_map(2, memory_config);
   loki_channel_memset_words(2, address, 0, num_words);
+
+  TRACE_END(start, TRACE_CLEAR, 0, num_words * sizeof(data_t));
+}
+
+void clear_activations(const activation_config_t* tensor, uint first_image,
+                       uint images, uint first_channel, uint channels,
+                       uint height, uint width) {
+  const int32_t word = sizeof(data_t);
+  int dense_rows = tensor->column_stride == word;
+  int dense_planes = dense_rows &&
+                     tensor->row_stride == (int32_t)width * word;
+  int dense_images = dense_planes &&
+                     tensor->channel_stride == (int32_t)height * width * word;
+
+  for (uint b=first_image; b<first_image+images; b++) {
+    data_t* image = tensor->data.address +
+                    (b * tensor->batch_stride +
+                     first_channel * tensor->channel_stride) / word;
+
+    if (dense_images) {
+      clear_memory(image, (size_t)channels * height * width * word / 4,
+                   tensor->data.memory_config);
+      continue;
+    }
+
+    for (uint c=0; c<channels; c++) {
+      data_t* plane = image + c * tensor->channel_stride / word;
+
+      if (dense_planes) {
+        clear_memory(plane, height * width * word / 4,
+                     tensor->data.memory_config);
+        continue;
+      }
+
+      for (uint row=0; row<height; row++) {
+        data_t* line = plane + row * tensor->row_stride / word;
+
+        if (dense_rows)
+          clear_memory(line, width * word / 4, tensor->data.memory_config);
+        else
+          for (uint col=0; col<width; col++)
+            line[col * tensor->column_stride / word] = 0;
+      }
+    }
+  }
 }
 
 activation_config_t* lat_conv2d_alloc(
   const activation_config_t* input,
   const filter_config_t* weights,
   const conv_shape_t* params,
-  const loop_nest_t* loop_order
+  const loop_nest_t* loop_order,
+  lat_arena_t* arena
 ) {
   uint batch = params->batch_size;
   uint channels = params->out_channels;
-  uint height = output_size(params->image_height, params->filter_height, params->stride, params->dilation);
-  uint width = output_size(params->image_width, params->filter_width, params->stride, params->dilation);
+  uint height = conv_output_height(params);
+  uint width = conv_output_width(params);
 
   activation_config_t* output =
-      init_activation_tensor(batch, channels, height, width);
+      init_activation_tensor(batch, channels, height, width, arena);
 
   // Default: use same memory group as `input`.
-  output->data.memory_config = input->data.memory_config;
-
-  // Initialise tensor contents to zero.
-  clear_memory(output->data.address, batch*channels*height*width*sizeof(data_t)/4, output->data.memory_config);
+  if (arena == NULL)
+    output->data.memory_config = input->data.memory_config;
 
-  lat_conv2d(input, weights, output, params, loop_order);
+  lat_conv2d_overwrite(input, weights, output, params, loop_order);
 
   return output;
 }
@@ -329,27 +857,28 @@ activation_config_t* lat_linear_alloc(
   uint32_t batch_size,
   uint32_t num_inputs,
   uint32_t num_outputs,
-  const loop_nest_t* loop_order
+  const loop_nest_t* loop_order,
+  lat_arena_t* arena
 ) {
   // Add dummy dimensions so this tensor can be passed to the convolution
   // function.
   activation_config_t* output =
-      init_activation_tensor(batch_size, num_outputs, 1, 1);
+      init_activation_tensor(batch_size, num_outputs, 1, 1, arena);
 
   // Default: use same memory group as `input`.
-  output->data.memory_config = input->data.memory_config;
-
-  // Initialise tensor contents to zero.
-  clear_memory(output->data.address, num_outputs*sizeof(data_t)/4, output->data.memory_config);
+  if (arena == NULL)
+    output->data.memory_config = input->data.memory_config;
 
-  lat_linear(input, weights, output, batch_size, num_inputs, num_outputs, loop_order);
+  lat_linear_overwrite(input, weights, output, batch_size, num_inputs,
+                       num_outputs, loop_order);
 
   return output;
 }
 
 activation_config_t* lat_max_pool_2d_alloc(
   const activation_config_t* input,
-  const pool_shape_t* params
+  const pool_shape_t* params,
+  lat_arena_t* arena
 ) {
   uint batch = params->batch_size;
   uint channels = params->channels;
@@ -357,10 +886,11 @@ activation_config_t* lat_max_pool_2d_alloc(
   uint width = output_size(params->input_width, params->window_width, params->stride, 1);
 
   activation_config_t* output =
-      init_activation_tensor(batch, channels, height, width);
+      init_activation_tensor(batch, channels, height, width, arena);
 
   // Default: use same memory group as `input`.
-  output->data.memory_config = input->data.memory_config;
+  if (arena == NULL)
+    output->data.memory_config = input->data.memory_config;
 
   lat_max_pool_2d(input, output, params);
 
@@ -369,7 +899,8 @@ activation_config_t* lat_max_pool_2d_alloc(
 
 activation_config_t* lat_avg_pool_2d_alloc(
   const activation_config_t* input,
-  const pool_shape_t* params
+  const pool_shape_t* params,
+  lat_arena_t* arena
 ) {
   uint batch = params->batch_size;
   uint channels = params->channels;
@@ -377,10 +908,11 @@ activation_config_t* lat_avg_pool_2d_alloc(
   uint width = output_size(params->input_width, params->window_width, params->stride, 1);
 
   activation_config_t* output =
-      init_activation_tensor(batch, channels, height, width);
+      init_activation_tensor(batch, channels, height, width, arena);
 
   // Default: use same memory group as `input`.
-  output->data.memory_config = input->data.memory_config;
+  if (arena == NULL)
+    output->data.memory_config = input->data.memory_config;
 
   lat_avg_pool_2d(input, output, params);
 
@@ -0,0 +1,237 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <loki/alloc.h>
+#include "nn/network.h"
+#include "internal.h"
+
+// Dimensions of a layer's output.
+static void output_shape(const lat_layer_t* layer, uint* batch,
+                         uint* channels, uint* height, uint* width) {
+  switch (layer->type) {
+    case LAYER_CONV2D:
+      *batch = layer->conv.batch_size;
+      *channels = layer->conv.out_channels;
+      *height = conv_output_height(&layer->conv);
+      *width = conv_output_width(&layer->conv);
+      break;
+
+    case LAYER_LINEAR:
+      *batch = layer->linear.batch_size;
+      *channels = layer->linear.num_outputs;
+      *height = 1;
+      *width = 1;
+      break;
+
+    case LAYER_MAX_POOL_2D:
+    case LAYER_AVG_POOL_2D:
+      *batch = layer->pool.batch_size;
+      *channels = layer->pool.channels;
+      *height = output_size(layer->pool.input_height,
+                            layer->pool.window_height, layer->pool.stride, 1);
+      *width = output_size(layer->pool.input_width,
+                           layer->pool.window_width, layer->pool.stride, 1);
+      break;
+
+    default:
+      printf("Unsupported layer type: %d\n", layer->type);
+      exit(1);
+  }
+}
+
+static size_t align(size_t bytes) {
+  return (bytes + LAT_ARENA_ALIGNMENT - 1) & ~(size_t)(LAT_ARENA_ALIGNMENT - 1);
+}
+
+// Assign each layer's output to a buffer, reusing buffers whose contents are
+// no longer needed. A tensor is live from the layer which produces it until
+// the last layer which reads it; the final layer's output stays live after
+// the network finishes. A layer's output never shares a buffer with its input.
+//
+// Layers are visited in order, and each output takes the smallest free buffer
+// which is large enough, or failing that, the largest free buffer (which
+// grows). A new buffer is added only if none are free.
+//
+// Fills in `offset` (bytes from the start of the network's memory) for each
+// layer, and returns the total size.
+static size_t plan_buffers(const lat_layer_t* layers, uint32_t layer_count,
+                           const size_t* bytes, size_t* offset,
+                           uint32_t* buffer_count) {
+  uint32_t last_use[layer_count];
+  for (uint i=0; i<layer_count; i++)
+    last_use[i] = i;
+  last_use[layer_count - 1] = layer_count;
+
+  for (uint i=0; i<layer_count; i++) {
+    assert(layers[i].input >= LAT_NETWORK_INPUT && layers[i].input < (int)i);
+    if (layers[i].input != LAT_NETWORK_INPUT && last_use[layers[i].input] < i)
+      last_use[layers[i].input] = i;
+  }
+
+  // At most one buffer per layer.
+  size_t buffer_size[layer_count];
+  uint32_t busy_until[layer_count];
+  uint32_t buffer_of[layer_count];
+  uint32_t buffers = 0;
+
+  for (uint i=0; i<layer_count; i++) {
+    int best = -1;
+
+    for (uint b=0; b<buffers; b++) {
+      if (busy_until[b] >= i)
+        continue;
+
+      if (best < 0) {
+        best = b;
+        continue;
+      }
+
+      int fits = buffer_size[b] >= bytes[i];
+      int best_fits = buffer_size[best] >= bytes[i];
+
+      if (fits && (!best_fits || buffer_size[b] < buffer_size[best]))
+        best = b;
+      else if (!fits && !best_fits && buffer_size[b] > buffer_size[best])
+        best = b;
+    }
+
+    if (best < 0) {
+      best = buffers++;
+      buffer_size[best] = 0;
+    }
+
+    if (buffer_size[best] < bytes[i])
+      buffer_size[best] = bytes[i];
+    busy_until[best] = last_use[i];
+    buffer_of[i] = best;
+  }
+
+  size_t buffer_offset[buffers];
+  size_t total = 0;
+  for (uint b=0; b<buffers; b++) {
+    buffer_offset[b] = total;
+    total += buffer_size[b];
+  }
+
+  for (uint i=0; i<layer_count; i++)
+    offset[i] = buffer_offset[buffer_of[i]];
+
+  *buffer_count = buffers;
+  return total;
+}
+
+lat_network_t* lat_network_create(
+  const lat_layer_t* layers,
+  uint32_t layer_count,
+  int memory_config,
+  lat_arena_t* arena
+) {
+  assert(layer_count > 0);
+
+  lat_network_t* network = allocate(arena, sizeof(lat_network_t));
+  if (network == NULL)
+    return NULL;
+
+  network->layer_count = layer_count;
+  network->layers = layers;
+  network->arena = arena;
+  network->memory = NULL;
+  network->outputs =
+      allocate(arena, layer_count * sizeof(activation_config_t));
+  if (network->outputs == NULL) {
+    lat_network_destroy(network);
+    return NULL;
+  }
+
+  uint shape[layer_count][4];
+  size_t bytes[layer_count];
+  size_t offset[layer_count];
+
+  for (uint i=0; i<layer_count; i++) {
+    output_shape(&layers[i], &shape[i][0], &shape[i][1], &shape[i][2],
+                 &shape[i][3]);
+    bytes[i] = align((size_t)shape[i][0] * shape[i][1] * shape[i][2] *
+                     shape[i][3] * sizeof(data_t));
+  }
+
+  network->memory_size = plan_buffers(layers, layer_count, bytes, offset,
+                                      &network->buffer_count);
+  network->memory = allocate(arena, network->memory_size);
+  if (network->memory == NULL) {
+    lat_network_destroy(network);
+    return NULL;
+  }
+
+  for (uint i=0; i<layer_count; i++) {
+    activation_config_t* output = &network->outputs[i];
+    output->data.address = (data_t*)(network->memory + offset[i]);
+    output->data.memory_config = memory_config;
+    set_default_strides(output, shape[i][1], shape[i][2], shape[i][3]);
+  }
+
+  return network;
+}
+
+void lat_network_destroy(lat_network_t* network) {
+  // Arena memory is freed when the arena is reset.
+  if (network->arena != NULL)
+    return;
+
+  if (network->memory != NULL)
+    loki_free(network->memory);
+  if (network->outputs != NULL)
+    loki_free(network->outputs);
+  loki_free(network);
+}
+
+static void run_layer(const lat_layer_t* layer,
+                      const activation_config_t* input,
+                      activation_config_t* output) {
+  switch (layer->type) {
+    // Buffers are shared, so outputs are overwritten rather than accumulated
+    // into.
+    case LAYER_CONV2D:
+      conv_chunked(input, layer->weights, output, &layer->conv,
+                   layer->loop_order, layer->epilogue, 1);
+      break;
+
+    case LAYER_LINEAR: {
+      const linear_shape_t* shape = &layer->linear;
+      conv_shape_t conv;
+      linear_shape(&conv, shape->batch_size, shape->num_inputs,
+                   shape->num_outputs);
+
+      conv_chunked(input, layer->weights, output, &conv, layer->loop_order,
+                   layer->epilogue, 1);
+      break;
+    }
+
+    case LAYER_MAX_POOL_2D:
+      lat_max_pool_2d(input, output, &layer->pool);
+      break;
+
+    case LAYER_AVG_POOL_2D:
+      lat_avg_pool_2d(input, output, &layer->pool);
+      break;
+
+    default:
+      printf("Unsupported layer type: %d\n", layer->type);
+      exit(1);
+  }
+}
+
+const activation_config_t* lat_network_run(
+  lat_network_t* network,
+  const activation_config_t* input
+) {
+  for (uint i=0; i<network->layer_count; i++) {
+    const lat_layer_t* layer = &network->layers[i];
+    const activation_config_t* layer_input = (layer->input == LAT_NETWORK_INPUT)
+        ? input : &network->outputs[layer->input];
+
+    assert(layer->epilogue == NULL || layer->epilogue->pool_output == NULL);
+    run_layer(layer, layer_input, &network->outputs[i]);
+  }
+
+  return &network->outputs[network->layer_count - 1];
+}
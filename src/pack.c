@@ -0,0 +1,107 @@
+#include <assert.h>
+#include <loki/alloc.h>
+#include "nn/layers.h"
+#include "nn/tuning.h"
+#include "internal.h"
+
+// Dimensions of a weight tensor, in the default order (outermost first).
+enum WeightDim {
+  DIM_GROUP,
+  DIM_OUT,
+  DIM_IN,
+  DIM_ROW,
+  DIM_COLUMN,
+  WEIGHT_DIMS
+};
+
+// Position of the loop which steps through a dimension, or -1 if there is
+// none (so the dimension can go anywhere, and is placed outermost).
+static int dim_position(const loop_nest_t* nest, enum Loop loop,
+                        enum Loop alternative) {
+  int position = find_loop(nest, loop);
+  return (position >= 0) ? position : find_loop(nest, alternative);
+}
+
+static inline const data_t* source_weight(const filter_config_t* weights,
+                                          const uint32_t* index) {
+  return weights->data.address + (index[DIM_GROUP] * weights->group_stride +
+         index[DIM_OUT] * weights->out_channel_stride +
+         index[DIM_IN] * weights->in_channel_stride +
+         index[DIM_ROW] * weights->row_stride +
+         index[DIM_COLUMN] * weights->column_stride) / (int)sizeof(data_t);
+}
+
+filter_config_t lat_pack_weights(
+  const filter_config_t* weights,
+  const conv_shape_t* params,
+  const loop_nest_t* loop_order
+) {
+  if (loop_order == NULL)
+    loop_order = lat_choose_loop_nest(params);
+
+  uint32_t size[WEIGHT_DIMS];
+  size[DIM_GROUP] = conv_groups(params);
+  size[DIM_OUT] = out_channels_per_group(params);
+  size[DIM_IN] = in_channels_per_group(params);
+  size[DIM_ROW] = params->filter_height;
+  size[DIM_COLUMN] = params->filter_width;
+
+  // Tiled channels stay in one dimension, placed where the loop within each
+  // tile is. Tiles are then contiguous blocks of that dimension.
+  int position[WEIGHT_DIMS];
+  position[DIM_GROUP] = find_loop(loop_order, GROUPS);
+  position[DIM_OUT] = dim_position(loop_order, OUT_CHANNELS,
+                                   OUT_CHANNEL_TILES);
+  position[DIM_IN] = dim_position(loop_order, IN_CHANNELS, IN_CHANNEL_TILES);
+  position[DIM_ROW] = dim_position(loop_order, FILTER_HEIGHT_OS,
+                                   FILTER_HEIGHT_IS);
+  position[DIM_COLUMN] = dim_position(loop_order, FILTER_WIDTH_OS,
+                                      FILTER_WIDTH_IS);
+
+  // Order dimensions by loop position, outermost first. Insertion sort keeps
+  // the default order for ties.
+  enum WeightDim order[WEIGHT_DIMS];
+  for (uint d=0; d<WEIGHT_DIMS; d++) {
+    uint j = d;
+    for (; j>0 && position[order[j-1]] > position[d]; j--)
+      order[j] = order[j-1];
+    order[j] = d;
+  }
+
+  // The innermost dimension is contiguous.
+  int32_t stride[WEIGHT_DIMS];
+  int32_t next_stride = sizeof(data_t);
+  for (int d=WEIGHT_DIMS-1; d>=0; d--) {
+    stride[order[d]] = next_stride;
+    next_stride *= size[order[d]];
+  }
+
+  filter_config_t packed;
+  packed.data.memory_config = weights->data.memory_config;
+  packed.group_stride = stride[DIM_GROUP];
+  packed.out_channel_stride = stride[DIM_OUT];
+  packed.in_channel_stride = stride[DIM_IN];
+  packed.row_stride = stride[DIM_ROW];
+  packed.column_stride = stride[DIM_COLUMN];
+
+  size_t words = (size_t)next_stride / sizeof(data_t);
+  packed.data.address = loki_malloc(words * sizeof(data_t));
+  if (packed.data.address == NULL)
+    return packed;
+
+  // Write in packed order, so the destination is sequential.
+  uint32_t index[WEIGHT_DIMS] = {0};
+  data_t* destination = packed.data.address;
+
+  for (size_t i=0; i<words; i++) {
+    *destination++ = *source_weight(weights, index);
+
+    for (int d=WEIGHT_DIMS-1; d>=0; d--) {
+      if (++index[order[d]] < size[order[d]])
+        break;
+      index[order[d]] = 0;
+    }
+  }
+
+  return packed;
+}
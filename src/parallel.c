@@ -0,0 +1,167 @@
+#include <assert.h>
+#include <loki/ids.h>
+#include <loki/init.h>
+#include "nn/layers.h"
+#include "nn/tuning.h"
+#include "internal.h"
+
+// Everything each tile needs to compute its share of a convolution. Copied to
+// every core, so holds values rather than pointers where possible.
+typedef struct {
+  activation_config_t input;
+  filter_config_t     weights;
+  activation_config_t output;
+  conv_shape_t        shape;
+  const loop_nest_t*  loop_order;
+  enum Partition      partition;
+  uint32_t            tiles;
+} parallel_conv_t;
+
+// Number of independent pieces of work available in the given dimension.
+static uint32_t partition_size(const conv_shape_t* shape,
+                               enum Partition partition) {
+  switch (partition) {
+    case PARTITION_OUT_CHANNELS: return (conv_groups(shape) > 1)
+                                      ? conv_groups(shape)
+                                      : shape->out_channels;
+    case PARTITION_BATCH:        return shape->batch_size;
+    case PARTITION_ROWS:         return conv_output_height(shape);
+    default:                     return 0;
+  }
+}
+
+// Prefer splitting output channels: each tile then reads only its own share of
+// the weights. Otherwise split whichever dimension has enough work to keep all
+// tiles busy.
+// Rows can't be split if there is vertical padding, since padding is the same
+// at the top and bottom of each partition.
+static enum Partition choose_partition(const conv_shape_t* shape,
+                                       uint32_t tiles) {
+  const enum Partition preferences[] = {
+    PARTITION_OUT_CHANNELS, PARTITION_BATCH, PARTITION_ROWS
+  };
+  uint options = (shape->padding_h > 0) ? 2 : 3;
+
+  enum Partition best = PARTITION_OUT_CHANNELS;
+  for (uint i=0; i<options; i++) {
+    uint32_t size = partition_size(shape, preferences[i]);
+    if (size >= tiles)
+      return preferences[i];
+    else if (size > partition_size(shape, best))
+      best = preferences[i];
+  }
+
+  return best;
+}
+
+// Compute this tile's share of the convolution. Runs on every core, but only
+// the first core of each tile uses the accelerator.
+static void conv2d_tile(const void* data) {
+  const parallel_conv_t* args = data;
+
+  if (get_core_id() != 0)
+    return;
+
+  uint32_t tile = get_unique_core_id() / LAT_CORES_PER_TILE;
+  if (tile >= args->tiles)
+    return;
+
+  activation_config_t input = args->input;
+  filter_config_t weights = args->weights;
+  activation_config_t output = args->output;
+  conv_shape_t shape = args->shape;
+
+  uint32_t first, count;
+  split_work(partition_size(&shape, args->partition), args->tiles, tile,
+             &first, &count);
+
+  if (count == 0)
+    return;
+
+  switch (args->partition) {
+    case PARTITION_OUT_CHANNELS:
+      // Grouped convolutions are split between groups, so each tile reads
+      // only the input channels its groups need.
+      if (conv_groups(&shape) > 1) {
+        uint32_t in_per_group = in_channels_per_group(&shape);
+        uint32_t out_per_group = out_channels_per_group(&shape);
+
+        input.data = offset_location(input.data,
+            first * in_per_group * input.channel_stride);
+        weights.data = offset_location(weights.data,
+            first * weights.group_stride);
+        output.data = offset_location(output.data,
+            first * out_per_group * output.channel_stride);
+        shape.groups = count;
+        shape.in_channels = count * in_per_group;
+        shape.out_channels = count * out_per_group;
+        break;
+      }
+
+      weights.data = offset_location(weights.data,
+                                     first * weights.out_channel_stride);
+      output.data = offset_location(output.data,
+                                    first * output.channel_stride);
+      shape.out_channels = count;
+      break;
+
+    case PARTITION_BATCH:
+      input.data = offset_location(input.data, first * input.batch_stride);
+      output.data = offset_location(output.data, first * output.batch_stride);
+      shape.batch_size = count;
+      break;
+
+    case PARTITION_ROWS:
+      // Each output row needs `stride` new input rows, plus the rows covered
+      // by the filter.
+      input.data = offset_location(input.data,
+                                   first * shape.stride * input.row_stride);
+      output.data = offset_location(output.data, first * output.row_stride);
+      shape.image_height = (count - 1) * shape.stride +
+                           shape.dilation * (shape.filter_height - 1) + 1;
+      break;
+
+    default:
+      return;
+  }
+
+  lat_conv2d(&input, &weights, &output, &shape, args->loop_order);
+}
+
+void lat_conv2d_parallel(
+  const activation_config_t* input,
+  const filter_config_t* weights,
+  activation_config_t* output,
+  const conv_shape_t* params,
+  const loop_nest_t* loop_order,
+  uint32_t tiles,
+  enum Partition partition
+) {
+  assert(tiles > 0);
+
+  // Choose here so the tuning cache is only accessed from this core.
+  if (loop_order == NULL)
+    loop_order = lat_choose_loop_nest(params);
+
+  if (partition == PARTITION_AUTO ||
+      (partition == PARTITION_ROWS && params->padding_h > 0))
+    partition = choose_partition(params, tiles);
+
+  parallel_conv_t args;
+  args.input = *input;
+  args.weights = *weights;
+  args.output = *output;
+  args.shape = *params;
+  args.loop_order = loop_order;
+  args.partition = partition;
+  args.tiles = tiles;
+
+  distributed_func config;
+  config.cores = tiles * LAT_CORES_PER_TILE;
+  config.func = conv2d_tile;
+  config.data = &args;
+  config.data_size = sizeof(args);
+
+  // Returns once all tiles have finished.
+  loki_execute(&config);
+}
@@ -0,0 +1,89 @@
+#include <assert.h>
+#include <loki/alloc.h>
+#include <loki/channels.h>
+#include <loki/ids.h>
+#include "nn/layers.h"
+#include "nn/tuning.h"
+#include "internal.h"
+
+lat_plan_t* lat_conv2d_plan_create(
+  const activation_config_t* input,
+  const filter_config_t* weights,
+  const conv_shape_t* params,
+  const loop_nest_t* loop_order
+) {
+  if (loop_order == NULL)
+    loop_order = lat_choose_loop_nest(params);
+
+  assert(conv_loop_count(loop_order, params) <= LAT_MAX_ASYNC_LOOPS);
+
+  lat_plan_t* plan = loki_malloc(sizeof(lat_plan_t));
+  if (plan == NULL)
+    return NULL;
+
+  // Only the layout of the output matters: its address is supplied later.
+  activation_config_t output;
+  output.data = input->data;
+  set_default_strides(&output, params->out_channels,
+                      conv_output_height(params), conv_output_width(params));
+
+  handle_state_t* handle = handle_state(&plan->handle);
+  conv_prepare(handle, handle->loops, handle->iteration_counts, input, weights,
+               &output, params, loop_order);
+
+  return plan;
+}
+
+lat_plan_t* lat_linear_plan_create(
+  const activation_config_t* input,
+  const filter_config_t* weights,
+  uint32_t batch_size,
+  uint32_t num_inputs,
+  uint32_t num_outputs,
+  const loop_nest_t* loop_order
+) {
+  conv_shape_t conv;
+  linear_shape(&conv, batch_size, num_inputs, num_outputs);
+
+  return lat_conv2d_plan_create(input, weights, &conv, loop_order);
+}
+
+void lat_plan_destroy(lat_plan_t* plan) {
+  loki_free(plan);
+}
+
+lat_handle_t* lat_plan_execute_async(
+  const lat_plan_t* plan,
+  const data_t* input,
+  data_t* output,
+  lat_handle_t* opaque
+) {
+  // The plan is shared, so work on a copy. Launching modifies the iteration
+  // counts, so the copy must use its own loop arrays.
+  *opaque = plan->handle;
+  handle_state_t* handle = handle_state(opaque);
+  handle->params.loops = handle->loops;
+  handle->params.iteration_counts = handle->iteration_counts;
+
+  // Notifications go to whichever core executes the plan.
+  uint32_t this_core = single_core_bitmask(get_core_id());
+  handle->params.notification_address =
+      loki_mcast_address(this_core, CH_REGISTER_3, 0);
+
+  handle->in1.address = (data_t*)input;
+  handle->out.address = output;
+
+  launch_next(handle);
+
+  return opaque;
+}
+
+void lat_plan_execute(
+  const lat_plan_t* plan,
+  const data_t* input,
+  data_t* output
+) {
+  lat_handle_t handle;
+  lat_plan_execute_async(plan, input, output, &handle);
+  lat_wait(&handle);
+}
@@ -0,0 +1,283 @@
+#include <stdio.h>
+#include <loki/ids.h>
+#include <loki/init.h>
+#include "nn/layers.h"
+#include "internal.h"
+
+// Library settings. These should be set once, before any layers run.
+static uint32_t cpu_cores = 1;
+static int warnings_enabled = 1;
+
+void lat_set_cpu_cores(uint32_t cores) {
+  assert(cores > 0);
+  cpu_cores = cores;
+}
+
+uint32_t get_cpu_cores(void) {
+  return cpu_cores;
+}
+
+void lat_set_warnings(int enabled) {
+  warnings_enabled = enabled;
+}
+
+// Number of output rows pooled together. Overlapping windows share work within
+// a group of rows, but each group needs scratch space on the stack.
+#define POOL_CHUNK_ROWS 4
+
+enum PoolOp {
+  POOL_MAX,
+  POOL_AVG
+};
+
+// Find the maximum of `count` windows of `window` elements, with the start of
+// each window `stride` elements after the previous one. Input elements are
+// `in_step` apart, and outputs `out_step` apart.
+//
+// Overlapping windows use the van Herk/Gil-Werman algorithm: the input is
+// split into blocks of `window` elements, and prefix/suffix maxima within each
+// block are computed. Every window spans at most two blocks, so its maximum is
+// the max of one suffix and one prefix. This costs three comparisons per
+// element, regardless of window size.
+static void sliding_max(const data_t* in, int in_step, uint window,
+                        uint stride, uint count, data_t* out, int out_step) {
+  if (stride >= window || window <= 2) {
+    for (uint i=0; i<count; i++) {
+      const data_t* ptr = in + i * stride * in_step;
+      data_t max = *ptr;
+
+      for (uint j=1; j<window; j++) {
+        ptr += in_step;
+        if (*ptr > max)
+          max = *ptr;
+      }
+
+      out[i * out_step] = max;
+    }
+    return;
+  }
+
+  uint length = (count - 1) * stride + window;
+  data_t prefix[length];
+  data_t suffix[length];
+
+  uint position = 0;  // Within block
+  for (uint i=0; i<length; i++) {
+    data_t value = in[i * in_step];
+    prefix[i] = (position == 0 || value > prefix[i-1]) ? value : prefix[i-1];
+
+    if (++position == window)
+      position = 0;
+  }
+
+  // `position` is now the offset of the end of the input within its block.
+  position = (position == 0) ? window - 1 : position - 1;
+  for (int i=length-1; i>=0; i--) {
+    data_t value = in[i * in_step];
+    int block_end = ((uint)i == length-1) || (position == window-1);
+    suffix[i] = (block_end || value > suffix[i+1]) ? value : suffix[i+1];
+
+    position = (position == 0) ? window - 1 : position - 1;
+  }
+
+  for (uint i=0; i<count; i++) {
+    uint start = i * stride;
+    data_t a = suffix[start];
+    data_t b = prefix[start + window - 1];
+    out[i * out_step] = (a > b) ? a : b;
+  }
+}
+
+// Sum `count` windows, with the same arguments as `sliding_max`. Overlapping
+// windows update a running sum with the elements entering and leaving the
+// window. If `reciprocal` is not NULL, each sum is divided by it.
+static void sliding_sum(const data_t* in, int in_step, uint window,
+                        uint stride, uint count, data_t* out, int out_step,
+                        const reciprocal_t* reciprocal) {
+  data_t sum = 0;
+
+  for (uint i=0; i<count; i++) {
+    const data_t* start = in + i * stride * in_step;
+
+    if (i == 0 || stride >= window) {
+      sum = 0;
+      for (uint j=0; j<window; j++)
+        sum += start[j * in_step];
+    }
+    else {
+      const data_t* leaving = start - stride * in_step;
+      const data_t* entering = leaving + window * in_step;
+      for (uint j=0; j<stride; j++)
+        sum += entering[j * in_step] - leaving[j * in_step];
+    }
+
+    out[i * out_step] = reciprocal ? divide(sum, reciprocal) : sum;
+  }
+}
+
+// Everything each core needs to compute its share of a pooling layer. Copied
+// to every core, so holds values rather than pointers.
+typedef struct {
+  activation_config_t input;
+  activation_config_t output;
+  pool_shape_t        shape;
+  enum PoolOp         op;
+  reciprocal_t        window_reciprocal;
+  uint32_t            cores;
+} pool_args_t;
+
+// Pool `rows` consecutive output rows of one channel of one image. Pooling is
+// separable: first reduce each input row horizontally, then reduce the results
+// vertically.
+static void pool_rows(const pool_args_t* args, uint b, uint ch,
+                      uint out_row, uint rows, uint out_width) {
+  const activation_config_t* input = &args->input;
+  const activation_config_t* output = &args->output;
+  const pool_shape_t* params = &args->shape;
+
+  uint in_rows = (rows - 1) * params->stride + params->window_height;
+
+  // Memory allocation is not multi-tile safe, so use the stack.
+  data_t pooled[in_rows * out_width];
+
+  int in_col_step = input->column_stride / (int)sizeof(data_t);
+  int in_row_step = input->row_stride / (int)sizeof(data_t);
+  data_t* in_ptr = input->data.address + (b*input->batch_stride +
+                   ch*input->channel_stride +
+                   out_row*params->stride*input->row_stride) / sizeof(data_t);
+
+  for (uint row=0; row<in_rows; row++) {
+    if (args->op == POOL_MAX)
+      sliding_max(in_ptr + row * in_row_step, in_col_step,
+                  params->window_width, params->stride, out_width,
+                  &pooled[row * out_width], 1);
+    else
+      sliding_sum(in_ptr + row * in_row_step, in_col_step,
+                  params->window_width, params->stride, out_width,
+                  &pooled[row * out_width], 1, NULL);
+  }
+
+  int out_col_step = output->column_stride / (int)sizeof(data_t);
+  int out_row_step = output->row_stride / (int)sizeof(data_t);
+  data_t* out_ptr = output->data.address + (b*output->batch_stride +
+                    ch*output->channel_stride +
+                    out_row*output->row_stride) / sizeof(data_t);
+
+  for (uint col=0; col<out_width; col++) {
+    if (args->op == POOL_MAX)
+      sliding_max(&pooled[col], out_width, params->window_height,
+                  params->stride, rows, out_ptr + col * out_col_step,
+                  out_row_step);
+    else
+      sliding_sum(&pooled[col], out_width, params->window_height,
+                  params->stride, rows, out_ptr + col * out_col_step,
+                  out_row_step, &args->window_reciprocal);
+  }
+}
+
+// Compute this core's share of the output rows. Rows from all images and
+// channels are divided evenly between cores.
+static void pool_2d_core(const void* data) {
+  const pool_args_t* args = data;
+  const pool_shape_t* params = &args->shape;
+
+  uint32_t core = (args->cores > 1) ? get_unique_core_id() : 0;
+
+  // TODO: dilation
+  uint out_height = output_size(params->input_height, params->window_height,
+                                params->stride, 1);
+  uint out_width = output_size(params->input_width, params->window_width,
+                               params->stride, 1);
+
+  if (out_width == 0)
+    return;
+
+  uint32_t first, count;
+  split_work(params->batch_size * params->channels * out_height, args->cores,
+             core, &first, &count);
+
+  // Work through this core's rows in chunks which don't cross channels.
+  uint32_t end = first + count;
+  for (uint32_t row=first; row<end; ) {
+    uint plane = row / out_height;
+    uint out_row = row % out_height;
+
+    uint rows = out_height - out_row;
+    if (rows > end - row)
+      rows = end - row;
+    if (rows > POOL_CHUNK_ROWS)
+      rows = POOL_CHUNK_ROWS;
+
+    pool_rows(args, plane / params->channels, plane % params->channels,
+              out_row, rows, out_width);
+    row += rows;
+  }
+}
+
+// Bytes read and written by a pooling layer.
+static inline uint64_t pool_traffic(const pool_shape_t* params) {
+  uint out_height = output_size(params->input_height, params->window_height,
+                                params->stride, 1);
+  uint out_width = output_size(params->input_width, params->window_width,
+                               params->stride, 1);
+  uint64_t words = (uint64_t)params->batch_size * params->channels *
+                   (params->input_height * params->input_width +
+                    out_height * out_width);
+  return words * sizeof(data_t);
+}
+
+static void pool_2d(
+  const activation_config_t* input,
+  activation_config_t* output,
+  const pool_shape_t* params,
+  enum PoolOp op
+) {
+  TRACE_BEGIN(start);
+
+  pool_args_t args;
+  args.input = *input;
+  args.output = *output;
+  args.shape = *params;
+  args.op = op;
+  args.window_reciprocal =
+      make_reciprocal(params->window_width * params->window_height);
+  args.cores = cpu_cores;
+
+  if (cpu_cores == 1) {
+    pool_2d_core(&args);
+  }
+  else {
+    distributed_func config;
+    config.cores = cpu_cores;
+    config.func = pool_2d_core;
+    config.data = &args;
+    config.data_size = sizeof(args);
+
+    // Returns once all cores have finished.
+    loki_execute(&config);
+  }
+
+  TRACE_END(start, TRACE_POOL, 0, pool_traffic(params));
+}
+
+void lat_max_pool_2d(
+  const activation_config_t* input,
+  activation_config_t* output,
+  const pool_shape_t* params
+) {
+  if (warnings_enabled)
+    fprintf(stderr, "Note: max pool is running on Loki CPU (unoptimised)\n");
+
+  pool_2d(input, output, params, POOL_MAX);
+}
+
+void lat_avg_pool_2d(
+  const activation_config_t* input,
+  activation_config_t* output,
+  const pool_shape_t* params
+) {
+  if (warnings_enabled)
+    fprintf(stderr, "Note: avg pool is running on Loki CPU (unoptimised)\n");
+
+  pool_2d(input, output, params, POOL_AVG);
+}
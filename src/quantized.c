@@ -0,0 +1,338 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <loki/alloc.h>
+#include "nn/quantized.h"
+#include "internal.h"
+
+// A positive real number represented as `multiplier * 2^-shift`, with
+// `multiplier` in [2^30, 2^31), so it can be applied with integer arithmetic.
+typedef struct {
+  int32_t multiplier;
+  int     shift;
+} fixed_t;
+
+static fixed_t make_fixed(double value) {
+  fixed_t fixed = {0, 0};
+  if (value <= 0)
+    return fixed;
+
+  // value = mantissa * 2^exponent, with mantissa in [0.5, 1).
+  double mantissa = value;
+  int exponent = 0;
+  while (mantissa >= 1) {
+    mantissa /= 2;
+    exponent++;
+  }
+  while (mantissa < 0.5) {
+    mantissa *= 2;
+    exponent--;
+  }
+
+  int64_t multiplier = (int64_t)(mantissa * (1ll << 31) + 0.5);
+  if (multiplier == (1ll << 31)) {
+    multiplier /= 2;
+    exponent++;
+  }
+
+  fixed.multiplier = multiplier;
+  fixed.shift = 31 - exponent;
+  return fixed;
+}
+
+// value * fixed, rounded to nearest.
+static inline int32_t apply_fixed(int32_t value, fixed_t fixed) {
+  int64_t product = (int64_t)value * fixed.multiplier;
+
+  if (fixed.shift <= 0)
+    return product << -fixed.shift;
+  else if (fixed.shift > 62)
+    return 0;
+  else
+    return (product + (1ll << (fixed.shift - 1))) >> fixed.shift;
+}
+
+static inline float quant_scale(const lat_quant_params_t* quant, uint i) {
+  return quant->scale[(quant->count == 1) ? 0 : i];
+}
+
+static inline int32_t quant_zero_point(const lat_quant_params_t* quant,
+                                       uint i) {
+  return quant->zero_point[(quant->count == 1) ? 0 : i];
+}
+
+static inline int32_t load(const char* address, enum DataType dtype) {
+  switch (dtype) {
+    case DTYPE_INT8:
+      return *(const int8_t*)address;
+    case DTYPE_INT16:
+      return *(const int16_t*)address;
+    default:
+      printf("Error: unsupported quantised DataType enum: %d\n", dtype);
+      exit(1);
+  }
+}
+
+// Store with saturation.
+static inline void store(char* address, enum DataType dtype, int32_t value) {
+  switch (dtype) {
+    case DTYPE_INT8:
+      if (value < INT8_MIN)
+        value = INT8_MIN;
+      else if (value > INT8_MAX)
+        value = INT8_MAX;
+      *(int8_t*)address = value;
+      break;
+    case DTYPE_INT16:
+      if (value < INT16_MIN)
+        value = INT16_MIN;
+      else if (value > INT16_MAX)
+        value = INT16_MAX;
+      *(int16_t*)address = value;
+      break;
+    default:
+      printf("Error: unsupported quantised DataType enum: %d\n", dtype);
+      exit(1);
+  }
+}
+
+// Copy one image (or one output channel of weights) of a 4D tensor into a
+// contiguous `data_t` buffer, removing the zero point of each channel. If
+// `per_outer` is set, dimension 0 selects the zero point (weights);
+// otherwise dimension 1 does (activations).
+static void widen(const lat_qtensor_t* tensor, uint outer, int per_outer,
+                  data_t* buffer) {
+  const lat_tensor_t* t = &tensor->tensor;
+  const char* base = (const char*)t->data.address +
+                     (ptrdiff_t)outer * t->strides[0];
+
+  for (uint c=0; c<t->shape[1]; c++) {
+    int32_t zero_point = quant_zero_point(&tensor->quant,
+                                          per_outer ? outer : c);
+    const char* plane = base + (ptrdiff_t)c * t->strides[1];
+
+    for (uint row=0; row<t->shape[2]; row++) {
+      const char* line = plane + (ptrdiff_t)row * t->strides[2];
+      for (uint col=0; col<t->shape[3]; col++)
+        *buffer++ = load(line + (ptrdiff_t)col * t->strides[3], t->dtype) -
+                    zero_point;
+    }
+  }
+}
+
+static const int32_t no_zero_point = 0;
+
+lat_quantized_filter_t* lat_quantized_filter_create(
+  const lat_qtensor_t* weights
+) {
+  const lat_tensor_t* t = &weights->tensor;
+  const uint32_t out_channels = t->shape[0];
+  const uint32_t filter_words = t->shape[1] * t->shape[2] * t->shape[3];
+
+  lat_quantized_filter_t* filter = loki_malloc(sizeof(lat_quantized_filter_t));
+  if (filter == NULL)
+    return NULL;
+
+  float* scale = loki_malloc(weights->quant.count * sizeof(float));
+  data_t* data = loki_malloc((size_t)out_channels * filter_words *
+                             sizeof(data_t));
+  if (scale == NULL || data == NULL) {
+    loki_free(scale);
+    loki_free(data);
+    loki_free(filter);
+    return NULL;
+  }
+
+  for (uint i=0; i<weights->quant.count; i++)
+    scale[i] = weights->quant.scale[i];
+
+  for (uint k=0; k<out_channels; k++)
+    widen(weights, k, 1, data + (size_t)k * filter_words);
+
+  memory_location_t location;
+  location.address = data;
+  location.memory_config = t->data.memory_config;
+  lat_tensor_init(&filter->tensor, location, DTYPE_DATA, 4, t->shape);
+
+  filter->quant.count = weights->quant.count;
+  filter->quant.scale = scale;
+  filter->quant.zero_point = &no_zero_point;
+
+  return filter;
+}
+
+void lat_quantized_filter_destroy(lat_quantized_filter_t* filter) {
+  loki_free(filter->tensor.data.address);
+  loki_free((float*)filter->quant.scale);
+  loki_free(filter);
+}
+
+void lat_quantized_conv2d(
+  const lat_qtensor_t* input,
+  const lat_quantized_filter_t* weights,
+  lat_qtensor_t* output,
+  const int32_t* bias,
+  const conv_options_t* options,
+  const loop_nest_t* loop_order,
+  lat_arena_t* arena
+) {
+  conv_shape_t shape = conv_shape_from_tensors(&input->tensor,
+                                               &weights->tensor,
+                                               &output->tensor, options);
+  assert(input->quant.count == 1);
+
+  const uint32_t out_channels = shape.out_channels;
+  const uint out_height = conv_output_height(&shape);
+  const uint out_width = conv_output_width(&shape);
+  const size_t in_words = (size_t)shape.in_channels * shape.image_height *
+                          shape.image_width;
+  const size_t out_words = (size_t)out_channels * out_height * out_width;
+
+  // Combined scale from accumulator to output, per output channel.
+  fixed_t requantise[out_channels];
+  for (uint k=0; k<out_channels; k++)
+    requantise[k] = make_fixed((double)quant_scale(&input->quant, 0) *
+                               quant_scale(&weights->quant, k) /
+                               quant_scale(&output->quant, k));
+
+  data_t* in_data = allocate(arena, in_words * sizeof(data_t));
+  data_t* out_data = allocate(arena, out_words * sizeof(data_t));
+  assert(in_data != NULL && out_data != NULL);
+
+  filter_config_t w = lat_filter_view(&weights->tensor, shape.groups);
+
+  activation_config_t in;
+  in.data.address = in_data;
+  in.data.memory_config = input->tensor.data.memory_config;
+  set_default_strides(&in, shape.in_channels, shape.image_height,
+                      shape.image_width);
+
+  activation_config_t out;
+  out.data.address = out_data;
+  out.data.memory_config = output->tensor.data.memory_config;
+  set_default_strides(&out, out_channels, out_height, out_width);
+
+  // One image at a time, to limit the size of the wide buffers.
+  conv_shape_t image_shape = shape;
+  image_shape.batch_size = 1;
+
+  const lat_tensor_t* result = &output->tensor;
+
+  for (uint b=0; b<shape.batch_size; b++) {
+    widen(input, b, 0, in_data);
+    lat_conv2d_overwrite(&in, &w, &out, &image_shape, loop_order);
+
+    const data_t* acc = out_data;
+    for (uint k=0; k<out_channels; k++) {
+      int32_t offset = (bias == NULL) ? 0 : bias[k];
+      int32_t zero_point = quant_zero_point(&output->quant, k);
+      char* plane = (char*)result->data.address +
+                    (ptrdiff_t)b * result->strides[0] +
+                    (ptrdiff_t)k * result->strides[1];
+
+      for (uint row=0; row<out_height; row++) {
+        char* line = plane + (ptrdiff_t)row * result->strides[2];
+        for (uint col=0; col<out_width; col++) {
+          int32_t value = apply_fixed(*acc++ + offset, requantise[k]);
+          store(line + (ptrdiff_t)col * result->strides[3], result->dtype,
+                value + zero_point);
+        }
+      }
+    }
+  }
+
+  if (arena == NULL) {
+    loki_free(in_data);
+    loki_free(out_data);
+  }
+}
+
+void lat_quantized_linear(
+  const lat_qtensor_t* input,
+  const lat_quantized_filter_t* weights,
+  lat_qtensor_t* output,
+  const int32_t* bias,
+  const loop_nest_t* loop_order,
+  lat_arena_t* arena
+) {
+  assert(input->tensor.shape[2] == 1 && input->tensor.shape[3] == 1);
+  lat_quantized_conv2d(input, weights, output, bias, NULL, loop_order, arena);
+}
+
+// Pool directly on the stored values. Maxima are found without conversion.
+// Averages are taken after removing each channel's zero point, so they round
+// the same way as `lat_avg_pool_2d` on the real values.
+static void quantized_pool(const lat_qtensor_t* input, lat_qtensor_t* output,
+                           uint32_t window_height, uint32_t window_width,
+                           uint32_t stride, int average) {
+  pool_shape_t shape = pool_shape_from_tensors(&input->tensor, &output->tensor,
+                                               window_height, window_width,
+                                               stride);
+  const lat_tensor_t* source = &input->tensor;
+  const lat_tensor_t* result = &output->tensor;
+  const uint out_height = result->shape[2];
+  const uint out_width = result->shape[3];
+  const reciprocal_t reciprocal = make_reciprocal(window_height * window_width);
+
+  for (uint b=0; b<shape.batch_size; b++) {
+    for (uint c=0; c<shape.channels; c++) {
+      int32_t in_zero_point = quant_zero_point(&input->quant, c);
+      int32_t out_zero_point = quant_zero_point(&output->quant, c);
+      const char* in_plane = (const char*)source->data.address +
+                             (ptrdiff_t)b * source->strides[0] +
+                             (ptrdiff_t)c * source->strides[1];
+      char* out_plane = (char*)result->data.address +
+                        (ptrdiff_t)b * result->strides[0] +
+                        (ptrdiff_t)c * result->strides[1];
+
+      for (uint row=0; row<out_height; row++) {
+        for (uint col=0; col<out_width; col++) {
+          const char* window = in_plane +
+              (ptrdiff_t)row * stride * source->strides[2] +
+              (ptrdiff_t)col * stride * source->strides[3];
+          int32_t value = average ? 0 : load(window, source->dtype);
+
+          for (uint y=0; y<window_height; y++) {
+            const char* line = window + (ptrdiff_t)y * source->strides[2];
+            for (uint x=0; x<window_width; x++) {
+              int32_t v = load(line + (ptrdiff_t)x * source->strides[3],
+                               source->dtype);
+              if (average)
+                value += v - in_zero_point;
+              else if (v > value)
+                value = v;
+            }
+          }
+
+          if (average)
+            value = divide(value, &reciprocal) + out_zero_point;
+          else
+            value += out_zero_point - in_zero_point;
+
+          store(out_plane + (ptrdiff_t)row * result->strides[2] +
+                (ptrdiff_t)col * result->strides[3], result->dtype, value);
+        }
+      }
+    }
+  }
+}
+
+void lat_quantized_max_pool_2d(
+  const lat_qtensor_t* input,
+  lat_qtensor_t* output,
+  uint32_t window_height,
+  uint32_t window_width,
+  uint32_t stride
+) {
+  quantized_pool(input, output, window_height, window_width, stride, 0);
+}
+
+void lat_quantized_avg_pool_2d(
+  const lat_qtensor_t* input,
+  lat_qtensor_t* output,
+  uint32_t window_height,
+  uint32_t window_width,
+  uint32_t stride
+) {
+  quantized_pool(input, output, window_height, window_width, stride, 1);
+}
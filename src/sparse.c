@@ -0,0 +1,258 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <loki/alloc.h>
+#include "nn/sparse.h"
+#include "internal.h"
+
+static inline const data_t* weight(const filter_config_t* weights, uint out,
+                                   uint in, uint row, uint col) {
+  return weights->data.address + (out*weights->out_channel_stride +
+         in*weights->in_channel_stride + row*weights->row_stride +
+         col*weights->column_stride) / (int)sizeof(data_t);
+}
+
+// First channel and number of channels in a block.
+static inline void block_range(uint32_t block, uint32_t block_size,
+                               uint32_t channels, uint32_t* first,
+                               uint32_t* count) {
+  *first = block * block_size;
+  *count = channels - *first;
+  if (*count > block_size)
+    *count = block_size;
+}
+
+static int block_is_zero(const filter_config_t* weights,
+                         const conv_shape_t* params, uint32_t out_first,
+                         uint32_t out_count, uint32_t in_first,
+                         uint32_t in_count) {
+  for (uint out=out_first; out<out_first+out_count; out++)
+    for (uint in=in_first; in<in_first+in_count; in++)
+      for (uint row=0; row<params->filter_height; row++)
+        for (uint col=0; col<params->filter_width; col++)
+          if (*weight(weights, out, in, row, col) != 0)
+            return 0;
+
+  return 1;
+}
+
+// Find the next run of neighbouring nonzero blocks in the block row of output
+// channels [out_first, out_first+out_count), starting the search at input
+// block `*first`. On success, the run is blocks [*first, *end). Returns 0 if
+// there are no more runs in the row.
+static int next_run(const filter_config_t* weights, const conv_shape_t* params,
+                    uint32_t out_first, uint32_t out_count, uint32_t in_block,
+                    uint32_t* first, uint32_t* end) {
+  const uint32_t in_blocks = (params->in_channels + in_block - 1) / in_block;
+  uint32_t in_first, in_count;
+
+  for (; *first<in_blocks; (*first)++) {
+    block_range(*first, in_block, params->in_channels, &in_first, &in_count);
+    if (!block_is_zero(weights, params, out_first, out_count, in_first,
+                       in_count))
+      break;
+  }
+
+  if (*first == in_blocks)
+    return 0;
+
+  for (*end=*first+1; *end<in_blocks; (*end)++) {
+    block_range(*end, in_block, params->in_channels, &in_first, &in_count);
+    if (block_is_zero(weights, params, out_first, out_count, in_first,
+                      in_count))
+      break;
+  }
+
+  return 1;
+}
+
+lat_sparse_filter_t* lat_sparse_filter_create(
+  const filter_config_t* weights,
+  const conv_shape_t* params,
+  uint32_t out_block,
+  uint32_t in_block
+) {
+  assert(out_block > 0 && in_block > 0);
+  if (conv_groups(params) != 1) {
+    printf("Error: sparse weights don't support grouped convolution\n");
+    exit(1);
+  }
+
+  const uint32_t out_blocks =
+      (params->out_channels + out_block - 1) / out_block;
+  const uint32_t in_blocks = (params->in_channels + in_block - 1) / in_block;
+  const uint32_t filter_size = params->filter_height * params->filter_width;
+
+  // Find the nonzero blocks first, to size the arrays. Blocks are checked
+  // again when copying, rather than stored, since there can be too many to
+  // keep on the stack.
+  uint32_t run_count = 0;
+  size_t words = 0;
+
+  for (uint ob=0; ob<out_blocks; ob++) {
+    uint32_t out_first, out_count;
+    block_range(ob, out_block, params->out_channels, &out_first, &out_count);
+
+    uint32_t first = 0, end;
+    while (next_run(weights, params, out_first, out_count, in_block, &first,
+                    &end)) {
+      uint32_t in_last = (end == in_blocks) ? params->in_channels
+                                            : end * in_block;
+      words += (size_t)out_count * (in_last - first * in_block) * filter_size;
+      run_count++;
+      first = end;
+    }
+  }
+
+  lat_sparse_filter_t* filter = loki_malloc(sizeof(lat_sparse_filter_t));
+  if (filter == NULL)
+    return NULL;
+
+  // Allocate at least one byte for each array, even if all weights are zero.
+  filter->row_start = loki_malloc((out_blocks + 1) * sizeof(uint32_t));
+  filter->runs = loki_malloc(run_count * sizeof(lat_sparse_run_t) + 1);
+  filter->data.address = loki_malloc(words * sizeof(data_t) + 1);
+  filter->data.memory_config = weights->data.memory_config;
+
+  if (filter->row_start == NULL || filter->runs == NULL ||
+      filter->data.address == NULL) {
+    lat_sparse_filter_destroy(filter);
+    return NULL;
+  }
+
+  filter->out_block = out_block;
+  filter->in_block = in_block;
+  filter->out_channels = params->out_channels;
+  filter->in_channels = params->in_channels;
+  filter->filter_height = params->filter_height;
+  filter->filter_width = params->filter_width;
+
+  uint32_t run = 0;
+  size_t offset = 0;
+
+  for (uint ob=0; ob<out_blocks; ob++) {
+    uint32_t out_first, out_count;
+    block_range(ob, out_block, params->out_channels, &out_first, &out_count);
+    filter->row_start[ob] = run;
+
+    uint32_t first = 0, end;
+    while (next_run(weights, params, out_first, out_count, in_block, &first,
+                    &end)) {
+      lat_sparse_run_t* r = &filter->runs[run++];
+      r->in_channel = first * in_block;
+      r->in_channels = ((end == in_blocks) ? params->in_channels
+                                           : end * in_block) - r->in_channel;
+      r->offset = offset;
+
+      for (uint out=out_first; out<out_first+out_count; out++)
+        for (uint in=r->in_channel; in<r->in_channel+r->in_channels; in++)
+          for (uint row=0; row<params->filter_height; row++)
+            for (uint col=0; col<params->filter_width; col++)
+              filter->data.address[offset++] =
+                  *weight(weights, out, in, row, col);
+
+      first = end;
+    }
+  }
+
+  filter->row_start[out_blocks] = run;
+
+  return filter;
+}
+
+void lat_sparse_filter_destroy(lat_sparse_filter_t* filter) {
+  if (filter->row_start != NULL)
+    loki_free(filter->row_start);
+  if (filter->runs != NULL)
+    loki_free(filter->runs);
+  if (filter->data.address != NULL)
+    loki_free(filter->data.address);
+  loki_free(filter);
+}
+
+float lat_sparse_filter_density(const lat_sparse_filter_t* filter) {
+  const uint32_t out_blocks =
+      (filter->out_channels + filter->out_block - 1) / filter->out_block;
+
+  size_t stored = 0;
+  for (uint ob=0; ob<out_blocks; ob++) {
+    uint32_t out_first, out_count;
+    block_range(ob, filter->out_block, filter->out_channels, &out_first,
+                &out_count);
+
+    for (uint r=filter->row_start[ob]; r<filter->row_start[ob+1]; r++)
+      stored += (size_t)out_count * filter->runs[r].in_channels;
+  }
+
+  size_t total = (size_t)filter->out_channels * filter->in_channels;
+  return (total == 0) ? 0 : (float)stored / total;
+}
+
+void lat_conv2d_sparse(
+  const activation_config_t* input,
+  const lat_sparse_filter_t* weights,
+  activation_config_t* output,
+  const conv_shape_t* params,
+  const loop_nest_t* loop_order
+) {
+  assert(conv_groups(params) == 1);
+  assert(weights->out_channels == params->out_channels);
+  assert(weights->in_channels == params->in_channels);
+  assert(weights->filter_height == params->filter_height);
+  assert(weights->filter_width == params->filter_width);
+
+  const uint32_t out_blocks =
+      (weights->out_channels + weights->out_block - 1) / weights->out_block;
+  const int32_t filter_bytes =
+      params->filter_height * params->filter_width * sizeof(data_t);
+
+  filter_config_t w;
+  w.data.memory_config = weights->data.memory_config;
+  w.column_stride = sizeof(data_t);
+  w.row_stride = params->filter_width * w.column_stride;
+  w.in_channel_stride = filter_bytes;
+  w.group_stride = 0;
+
+  // Each run is a small dense convolution on a subset of the channels.
+  for (uint ob=0; ob<out_blocks; ob++) {
+    uint32_t out_first, out_count;
+    block_range(ob, weights->out_block, weights->out_channels, &out_first,
+                &out_count);
+
+    activation_config_t out = *output;
+    out.data = offset_location(output->data,
+                               out_first * output->channel_stride);
+
+    for (uint r=weights->row_start[ob]; r<weights->row_start[ob+1]; r++) {
+      const lat_sparse_run_t* run = &weights->runs[r];
+
+      activation_config_t in = *input;
+      in.data = offset_location(input->data,
+                                run->in_channel * input->channel_stride);
+
+      w.data.address = weights->data.address + run->offset;
+      w.out_channel_stride = run->in_channels * filter_bytes;
+
+      conv_shape_t shape = *params;
+      shape.in_channels = run->in_channels;
+      shape.out_channels = out_count;
+
+      lat_conv2d(&in, &w, &out, &shape, loop_order);
+    }
+  }
+}
+
+void lat_linear_sparse(
+  const activation_config_t* input,
+  const lat_sparse_filter_t* weights,
+  activation_config_t* output,
+  uint32_t batch_size,
+  uint32_t num_inputs,
+  uint32_t num_outputs,
+  const loop_nest_t* loop_order
+) {
+  conv_shape_t conv;
+  linear_shape(&conv, batch_size, num_inputs, num_outputs);
+
+  lat_conv2d_sparse(input, weights, output, &conv, loop_order);
+}
@@ -0,0 +1,216 @@
+#include <assert.h>
+#include <loki/alloc.h>
+#include <loki/ids.h>
+#include <loki/init.h>
+#include "nn/stream.h"
+#include "internal.h"
+
+// Number of chunks a batch is split into if the stream doesn't say.
+#ifndef STREAM_CHUNKS
+#define STREAM_CHUNKS 4
+#endif
+
+// CPU-side work done while the accelerator computes one chunk. Copied to every
+// core, so holds values rather than pointers to local state.
+typedef struct {
+  lat_stream_t         stream;
+  uint32_t             cores;
+
+  // Chunk to stage next, if `stage_count` > 0.
+  uint32_t             stage_first;
+  uint32_t             stage_count;
+  activation_config_t  stage_buffer;
+
+  // Chunk to drain, if `drain_count` > 0. Its buffer is cleared afterwards,
+  // ready for the chunk after next.
+  uint32_t             drain_first;
+  uint32_t             drain_count;
+  activation_config_t  drain_buffer;
+  size_t               drain_words;
+} stream_work_t;
+
+static void stage(const stream_work_t* work) {
+  if (work->stage_count == 0)
+    return;
+
+  activation_config_t buffer = work->stage_buffer;
+  work->stream.stage(work->stream.context, work->stage_first,
+                     work->stage_count, &buffer);
+}
+
+static void drain(const stream_work_t* work) {
+  if (work->drain_count == 0)
+    return;
+
+  work->stream.drain(work->stream.context, work->drain_first,
+                     work->drain_count, &work->drain_buffer);
+  clear_memory(work->drain_buffer.data.address, work->drain_words,
+               work->drain_buffer.data.memory_config);
+}
+
+// With two cores, one stages and the other drains.
+static void stream_work_core(const void* data) {
+  const stream_work_t* work = data;
+  uint32_t core = (work->cores > 1) ? get_unique_core_id() : 0;
+
+  if (core == 0)
+    stage(work);
+  else
+    drain(work);
+}
+
+static void do_work(stream_work_t* work) {
+  if (get_cpu_cores() < 2) {
+    stage(work);
+    drain(work);
+    return;
+  }
+
+  work->cores = 2;
+
+  distributed_func config;
+  config.cores = work->cores;
+  config.func = stream_work_core;
+  config.data = work;
+  config.data_size = sizeof(stream_work_t);
+
+  // Returns once both cores have finished.
+  loki_execute(&config);
+}
+
+void lat_conv2d_stream(
+  const filter_config_t* weights,
+  const conv_shape_t* params,
+  const loop_nest_t* loop_order,
+  const lat_stream_t* stream,
+  lat_arena_t* arena
+) {
+  assert(stream->stage != NULL && stream->drain != NULL);
+
+  const uint32_t batch = params->batch_size;
+  if (batch == 0)
+    return;
+
+  uint32_t chunk_size = stream->chunk_size;
+  if (chunk_size == 0)
+    chunk_size = (batch + STREAM_CHUNKS - 1) / STREAM_CHUNKS;
+  if (chunk_size > batch)
+    chunk_size = batch;
+
+  const uint32_t chunks = (batch + chunk_size - 1) / chunk_size;
+  const uint32_t last_size = batch - (chunks - 1) * chunk_size;
+
+  const uint out_height = conv_output_height(params);
+  const uint out_width = conv_output_width(params);
+  const size_t in_words = (size_t)chunk_size * params->in_channels *
+                          params->image_height * params->image_width;
+  const size_t out_words = (size_t)chunk_size * params->out_channels *
+                           out_height * out_width;
+  const int memory_config = (arena == NULL) ? weights->data.memory_config
+                                            : arena->memory_config;
+
+  // Two of everything: one chunk being computed, and one being staged or
+  // drained.
+  activation_config_t in[2], out[2];
+  for (uint i=0; i<2; i++) {
+    in[i].data.address = allocate(arena, in_words * sizeof(data_t));
+    in[i].data.memory_config = memory_config;
+    set_default_strides(&in[i], params->in_channels, params->image_height,
+                        params->image_width);
+
+    out[i].data.address = allocate(arena, out_words * sizeof(data_t));
+    out[i].data.memory_config = memory_config;
+    set_default_strides(&out[i], params->out_channels, out_height,
+                        out_width);
+
+    assert(in[i].data.address != NULL && out[i].data.address != NULL);
+    clear_memory(out[i].data.address, out_words * sizeof(data_t) / 4,
+                 memory_config);
+  }
+
+  // Every chunk has the same shape, apart from possibly the last, so the
+  // accelerator parameters only need to be computed once or twice.
+  conv_shape_t chunk_shape = *params;
+  chunk_shape.batch_size = chunk_size;
+  lat_plan_t* full_plan = lat_conv2d_plan_create(&in[0], weights,
+                                                 &chunk_shape, loop_order);
+  lat_plan_t* last_plan = full_plan;
+  if (last_size != chunk_size) {
+    chunk_shape.batch_size = last_size;
+    last_plan = lat_conv2d_plan_create(&in[0], weights, &chunk_shape,
+                                       loop_order);
+  }
+  assert(full_plan != NULL && last_plan != NULL);
+
+  stream_work_t work;
+  work.stream = *stream;
+  work.cores = 1;
+  work.drain_words = out_words * sizeof(data_t) / 4;
+
+  // Stage the first chunk before anything can overlap with it.
+  work.stage_first = 0;
+  work.stage_count = (chunks == 1) ? last_size : chunk_size;
+  work.stage_buffer = in[0];
+  work.drain_count = 0;
+  stage(&work);
+
+  lat_handle_t handle;
+
+  for (uint32_t chunk=0; chunk<chunks; chunk++) {
+    uint current = chunk % 2;
+    uint other = 1 - current;
+
+    const lat_plan_t* plan = (chunk == chunks - 1) ? last_plan : full_plan;
+    lat_plan_execute_async(plan, in[current].data.address,
+                           out[current].data.address, &handle);
+
+    // Stage the next chunk and drain the previous one, both of which use the
+    // other buffers.
+    uint32_t next = chunk + 1;
+    work.stage_first = next * chunk_size;
+    work.stage_count = (next >= chunks) ? 0 :
+                       (next == chunks - 1) ? last_size : chunk_size;
+    work.stage_buffer = in[other];
+
+    work.drain_first = (chunk - 1) * chunk_size;
+    work.drain_count = (chunk == 0) ? 0 : chunk_size;
+    work.drain_buffer = out[other];
+
+    do_work(&work);
+
+    lat_wait(&handle);
+  }
+
+  // Nothing left to overlap with the final drain.
+  work.stage_count = 0;
+  work.drain_first = (chunks - 1) * chunk_size;
+  work.drain_count = last_size;
+  work.drain_buffer = out[(chunks - 1) % 2];
+  drain(&work);
+
+  if (last_plan != full_plan)
+    lat_plan_destroy(last_plan);
+  lat_plan_destroy(full_plan);
+
+  if (arena == NULL) {
+    for (uint i=0; i<2; i++) {
+      loki_free(in[i].data.address);
+      loki_free(out[i].data.address);
+    }
+  }
+}
+
+void lat_linear_stream(
+  const filter_config_t* weights,
+  uint32_t batch_size,
+  uint32_t num_inputs,
+  uint32_t num_outputs,
+  const loop_nest_t* loop_order,
+  const lat_stream_t* stream,
+  lat_arena_t* arena
+) {
+  conv_shape_t conv;
+  linear_shape(&conv, batch_size, num_inputs, num_outputs);
+
+  lat_conv2d_stream(weights, &conv, loop_order, stream, arena);
+}
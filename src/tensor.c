@@ -0,0 +1,381 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <loki/ids.h>
+#include <loki/init.h>
+#include "nn/layers.h"
+#include "internal.h"
+
+// Side length (in elements) of the square blocks used when transposing, so
+// that both the reads and writes of a block stay in cache.
+#ifndef TRANSPOSE_BLOCK
+#define TRANSPOSE_BLOCK 8
+#endif
+
+size_t lat_dtype_size(enum DataType dtype) {
+  switch (dtype) {
+    case DTYPE_DATA:
+      return sizeof(data_t);
+    case DTYPE_INT16:
+      return sizeof(int16_t);
+    case DTYPE_INT8:
+      return sizeof(int8_t);
+    default:
+      printf("Error: unsupported DataType enum: %d\n", dtype);
+      exit(1);
+  }
+}
+
+void lat_tensor_init(lat_tensor_t* tensor, memory_location_t data,
+                     enum DataType dtype, uint32_t dimensions,
+                     const uint32_t* shape) {
+  assert(dimensions <= LAT_MAX_DIMENSIONS);
+
+  tensor->data = data;
+  tensor->dtype = dtype;
+  tensor->dimensions = dimensions;
+
+  int32_t stride = lat_dtype_size(dtype);
+  for (int i=dimensions-1; i>=0; i--) {
+    tensor->shape[i] = shape[i];
+    tensor->strides[i] = stride;
+    stride *= shape[i];
+  }
+}
+
+void lat_tensor_init_4d(lat_tensor_t* tensor, memory_location_t data,
+                        enum DataType dtype, uint32_t d0, uint32_t d1,
+                        uint32_t d2, uint32_t d3, enum Layout layout) {
+  // Logical dimensions in memory order, outermost first.
+  static const uint32_t orders[][4] = {
+    [LAYOUT_NCHW] = {0, 1, 2, 3},
+    [LAYOUT_NHWC] = {0, 2, 3, 1},
+    [LAYOUT_OIHW] = {0, 1, 2, 3},
+    [LAYOUT_HWIO] = {2, 3, 1, 0}
+  };
+
+  if (layout > LAYOUT_HWIO) {
+    printf("Error: unsupported Layout enum: %d\n", layout);
+    exit(1);
+  }
+
+  uint32_t shape[4] = {d0, d1, d2, d3};
+  const uint32_t* order = orders[layout];
+
+  tensor->data = data;
+  tensor->dtype = dtype;
+  tensor->dimensions = 4;
+
+  int32_t stride = lat_dtype_size(dtype);
+  for (int i=3; i>=0; i--) {
+    tensor->shape[order[i]] = shape[order[i]];
+    tensor->strides[order[i]] = stride;
+    stride *= shape[order[i]];
+  }
+}
+
+size_t lat_tensor_elements(const lat_tensor_t* tensor) {
+  size_t elements = 1;
+  for (uint i=0; i<tensor->dimensions; i++)
+    elements *= tensor->shape[i];
+  return elements;
+}
+
+lat_tensor_t lat_tensor_slice(const lat_tensor_t* tensor, uint32_t dimension,
+                              uint32_t first, uint32_t count) {
+  assert(dimension < tensor->dimensions);
+  assert(first + count <= tensor->shape[dimension]);
+
+  lat_tensor_t slice = *tensor;
+  slice.data = offset_location(tensor->data,
+                               (int32_t)first * tensor->strides[dimension]);
+  slice.shape[dimension] = count;
+  return slice;
+}
+
+// Copy `count` elements with the given strides. Each element size gets its
+// own loop so the copy is a single load and store.
+#define DEFINE_COPY(NAME, TYPE)                                               \
+static void NAME(char* dst, int32_t dst_stride, const char* src,              \
+                 int32_t src_stride, uint32_t count) {                        \
+  for (uint32_t i=0; i<count; i++) {                                          \
+    *(TYPE*)dst = *(const TYPE*)src;                                          \
+    dst += dst_stride;                                                        \
+    src += src_stride;                                                        \
+  }                                                                           \
+}
+
+DEFINE_COPY(copy_8, int8_t)
+DEFINE_COPY(copy_16, int16_t)
+DEFINE_COPY(copy_32, int32_t)
+
+typedef void (*copy_func_t)(char*, int32_t, const char*, int32_t, uint32_t);
+
+static void copy_run(char* dst, int32_t dst_stride, const char* src,
+                     int32_t src_stride, uint32_t count, size_t size,
+                     copy_func_t copy) {
+  if (dst_stride == (int32_t)size && src_stride == (int32_t)size)
+    memcpy(dst, src, count * size);
+  else
+    copy(dst, dst_stride, src, src_stride, count);
+}
+
+typedef struct {
+  lat_tensor_t src;
+  lat_tensor_t dst;
+  uint32_t     cores;
+
+  // Dimensions along which `dst` and `src` are closest to contiguous.
+  int          dst_inner;
+  int          src_inner;
+} convert_args_t;
+
+// Dimension with the smallest stride (ignoring dimensions of size 1), or -1
+// if all dimensions have size 1.
+static int innermost_dimension(const lat_tensor_t* tensor) {
+  int inner = -1;
+  for (uint i=0; i<tensor->dimensions; i++) {
+    if (tensor->shape[i] == 1)
+      continue;
+    if (inner < 0 || abs(tensor->strides[i]) < abs(tensor->strides[inner]))
+      inner = i;
+  }
+  return inner;
+}
+
+// Copy this core's share of a tensor. The innermost dimensions are copied as
+// a unit (a row, or a transposed block); everything else is split between
+// cores.
+static void convert_core(const void* data) {
+  const convert_args_t* args = data;
+  const lat_tensor_t* src = &args->src;
+  const lat_tensor_t* dst = &args->dst;
+  const int a = args->dst_inner;
+  const int b = args->src_inner;
+
+  size_t size = lat_dtype_size(src->dtype);
+  copy_func_t copy = (size == 1) ? copy_8 : (size == 2) ? copy_16 : copy_32;
+
+  uint32_t outer = 1;
+  for (uint i=0; i<src->dimensions; i++)
+    if ((int)i != a && (int)i != b)
+      outer *= src->shape[i];
+
+  uint32_t core = (args->cores > 1) ? get_unique_core_id() : 0;
+  uint32_t first, count;
+  split_work(outer, args->cores, core, &first, &count);
+
+  for (uint32_t index=first; index<first+count; index++) {
+    // Find the start of this unit of work in both tensors.
+    const char* s = (const char*)src->data.address;
+    char* d = (char*)dst->data.address;
+    uint32_t remaining = index;
+    for (int i=src->dimensions-1; i>=0; i--) {
+      if (i == a || i == b)
+        continue;
+      uint32_t position = remaining % src->shape[i];
+      remaining /= src->shape[i];
+      s += (ptrdiff_t)position * src->strides[i];
+      d += (ptrdiff_t)position * dst->strides[i];
+    }
+
+    if (a < 0) {
+      copy(d, 0, s, 0, 1);
+    }
+    else if (a == b) {
+      copy_run(d, dst->strides[a], s, src->strides[a], src->shape[a], size,
+               copy);
+    }
+    else {
+      // Transpose in blocks. Writes to `dst` are sequential within each block.
+      for (uint32_t j0=0; j0<src->shape[b]; j0+=TRANSPOSE_BLOCK) {
+        uint32_t j_end = j0 + TRANSPOSE_BLOCK;
+        if (j_end > src->shape[b])
+          j_end = src->shape[b];
+
+        for (uint32_t i0=0; i0<src->shape[a]; i0+=TRANSPOSE_BLOCK) {
+          uint32_t i_count = src->shape[a] - i0;
+          if (i_count > TRANSPOSE_BLOCK)
+            i_count = TRANSPOSE_BLOCK;
+
+          for (uint32_t j=j0; j<j_end; j++)
+            copy(d + (ptrdiff_t)i0 * dst->strides[a] +
+                     (ptrdiff_t)j * dst->strides[b], dst->strides[a],
+                 s + (ptrdiff_t)i0 * src->strides[a] +
+                     (ptrdiff_t)j * src->strides[b], src->strides[a],
+                 i_count);
+        }
+      }
+    }
+  }
+}
+
+void lat_tensor_convert(const lat_tensor_t* src, lat_tensor_t* dst) {
+  assert(src->dtype == dst->dtype);
+  assert(src->dimensions == dst->dimensions);
+  for (uint i=0; i<src->dimensions; i++)
+    assert(src->shape[i] == dst->shape[i]);
+
+  if (lat_tensor_elements(src) == 0)
+    return;
+
+  convert_args_t args;
+  args.src = *src;
+  args.dst = *dst;
+  args.cores = get_cpu_cores();
+  args.dst_inner = innermost_dimension(dst);
+  args.src_inner = innermost_dimension(src);
+
+  // Only one inner dimension is needed if the tensor has a single dimension
+  // of size > 1.
+  if (args.dst_inner < 0 || args.src_inner < 0)
+    args.dst_inner = args.src_inner = -1;
+
+  if (args.cores == 1) {
+    convert_core(&args);
+  }
+  else {
+    distributed_func config;
+    config.cores = args.cores;
+    config.func = convert_core;
+    config.data = &args;
+    config.data_size = sizeof(args);
+
+    // Returns once all cores have finished.
+    loki_execute(&config);
+  }
+}
+
+activation_config_t lat_activation_view(const lat_tensor_t* tensor) {
+  assert(tensor->dimensions == 4);
+  assert(tensor->dtype == DTYPE_DATA);
+
+  activation_config_t view;
+  view.data = tensor->data;
+  view.batch_stride = tensor->strides[0];
+  view.channel_stride = tensor->strides[1];
+  view.row_stride = tensor->strides[2];
+  view.column_stride = tensor->strides[3];
+  return view;
+}
+
+filter_config_t lat_filter_view(const lat_tensor_t* tensor, uint32_t groups) {
+  assert(tensor->dimensions == 4);
+  assert(tensor->dtype == DTYPE_DATA);
+
+  if (groups == 0)
+    groups = 1;
+
+  filter_config_t view;
+  view.data = tensor->data;
+  view.out_channel_stride = tensor->strides[0];
+  view.in_channel_stride = tensor->strides[1];
+  view.row_stride = tensor->strides[2];
+  view.column_stride = tensor->strides[3];
+  view.group_stride = tensor->strides[0] * (tensor->shape[0] / groups);
+  return view;
+}
+
+conv_shape_t conv_shape_from_tensors(const lat_tensor_t* input,
+                                     const lat_tensor_t* weights,
+                                     const lat_tensor_t* output,
+                                     const conv_options_t* options) {
+  conv_shape_t shape;
+  shape.batch_size = input->shape[0];
+  shape.in_channels = input->shape[1];
+  shape.image_height = input->shape[2];
+  shape.image_width = input->shape[3];
+  shape.out_channels = weights->shape[0];
+  shape.filter_height = weights->shape[2];
+  shape.filter_width = weights->shape[3];
+
+  shape.groups = (options == NULL) ? 0 : options->groups;
+  shape.stride = (options == NULL) ? 0 : options->stride;
+  shape.dilation = (options == NULL) ? 0 : options->dilation;
+  shape.padding_h = (options == NULL) ? 0 : options->padding_h;
+  shape.padding_w = (options == NULL) ? 0 : options->padding_w;
+
+  if (shape.stride == 0)
+    shape.stride = 1;
+  if (shape.dilation == 0)
+    shape.dilation = 1;
+
+  assert(weights->shape[1] * conv_groups(&shape) == shape.in_channels);
+  assert(output->shape[0] == shape.batch_size);
+  assert(output->shape[1] == shape.out_channels);
+  assert(output->shape[2] == conv_output_height(&shape));
+  assert(output->shape[3] == conv_output_width(&shape));
+
+  return shape;
+}
+
+void lat_conv2d_tensor(
+  const lat_tensor_t* input,
+  const lat_tensor_t* weights,
+  lat_tensor_t* output,
+  const conv_options_t* options,
+  const loop_nest_t* loop_order
+) {
+  conv_shape_t shape = conv_shape_from_tensors(input, weights, output,
+                                               options);
+
+  activation_config_t in = lat_activation_view(input);
+  filter_config_t w = lat_filter_view(weights, shape.groups);
+  activation_config_t out = lat_activation_view(output);
+
+  lat_conv2d(&in, &w, &out, &shape, loop_order);
+}
+
+pool_shape_t pool_shape_from_tensors(const lat_tensor_t* input,
+                                     const lat_tensor_t* output,
+                                     uint32_t window_height,
+                                     uint32_t window_width, uint32_t stride) {
+  pool_shape_t shape;
+  shape.batch_size = input->shape[0];
+  shape.channels = input->shape[1];
+  shape.input_height = input->shape[2];
+  shape.input_width = input->shape[3];
+  shape.window_height = window_height;
+  shape.window_width = window_width;
+  shape.stride = stride;
+
+  assert(output->shape[0] == shape.batch_size);
+  assert(output->shape[1] == shape.channels);
+  assert(output->shape[2] ==
+         output_size(shape.input_height, window_height, stride, 1));
+  assert(output->shape[3] ==
+         output_size(shape.input_width, window_width, stride, 1));
+
+  return shape;
+}
+
+void lat_max_pool_2d_tensor(
+  const lat_tensor_t* input,
+  lat_tensor_t* output,
+  uint32_t window_height,
+  uint32_t window_width,
+  uint32_t stride
+) {
+  pool_shape_t shape = pool_shape_from_tensors(input, output, window_height,
+                                               window_width, stride);
+  activation_config_t in = lat_activation_view(input);
+  activation_config_t out = lat_activation_view(output);
+
+  lat_max_pool_2d(&in, &out, &shape);
+}
+
+void lat_avg_pool_2d_tensor(
+  const lat_tensor_t* input,
+  lat_tensor_t* output,
+  uint32_t window_height,
+  uint32_t window_width,
+  uint32_t stride
+) {
+  pool_shape_t shape = pool_shape_from_tensors(input, output, window_height,
+                                               window_width, stride);
+  activation_config_t in = lat_activation_view(input);
+  activation_config_t out = lat_activation_view(output);
+
+  lat_avg_pool_2d(&in, &out, &shape);
+}
@@ -0,0 +1,162 @@
+#include <inttypes.h>
+#include "nn/trace.h"
+#include "internal.h"
+
+static const char* event_names[TRACE_EVENT_COUNT] = {
+  "conv2d",
+  "setup",
+  "accelerate",
+  "sync",
+  "clear",
+  "pool"
+};
+
+const char* lat_trace_event_name(enum TraceEvent event) {
+  return (event < TRACE_EVENT_COUNT) ? event_names[event] : "unknown";
+}
+
+#ifdef LAT_TRACE
+
+#include <loki/control_registers.h>
+#include <loki/ids.h>
+
+int trace_enabled = 0;
+
+// One ring buffer per core. Each is only written by its own core, so no
+// locking is needed. `recorded` counts all events ever written, so the next
+// slot is `recorded % LAT_TRACE_BUFFER_SIZE`.
+typedef struct {
+  uint32_t          recorded;
+  lat_trace_event_t events[LAT_TRACE_BUFFER_SIZE];
+} trace_buffer_t;
+
+static trace_buffer_t buffers[LAT_TRACE_MAX_CORES];
+
+uint64_t trace_time(void) {
+  return get_cycle_count();
+}
+
+void trace_record(enum TraceEvent event, uint64_t start, uint64_t macs,
+                  uint64_t bytes) {
+  uint32_t core = get_unique_core_id();
+
+  // Tracing may have started part way through the event.
+  if (start == 0 || core >= LAT_TRACE_MAX_CORES)
+    return;
+
+  trace_buffer_t* buffer = &buffers[core];
+  lat_trace_event_t* e =
+      &buffer->events[buffer->recorded % LAT_TRACE_BUFFER_SIZE];
+  e->start = start;
+  e->end = get_cycle_count();
+  e->event = event;
+  e->core = core;
+  e->macs = macs;
+  e->bytes = bytes;
+  buffer->recorded++;
+}
+
+void lat_trace_start(void) {
+  for (uint core=0; core<LAT_TRACE_MAX_CORES; core++)
+    buffers[core].recorded = 0;
+  trace_enabled = 1;
+}
+
+void lat_trace_stop(void) {
+  trace_enabled = 0;
+}
+
+// Number of events held for `core`.
+static uint32_t available(uint32_t core) {
+  uint32_t recorded = buffers[core].recorded;
+  return (recorded > LAT_TRACE_BUFFER_SIZE) ? LAT_TRACE_BUFFER_SIZE : recorded;
+}
+
+// Event `index` held for `core`, oldest first.
+static const lat_trace_event_t* event_at(uint32_t core, uint32_t index) {
+  const trace_buffer_t* buffer = &buffers[core];
+  uint32_t first = buffer->recorded - available(core);
+  return &buffer->events[(first + index) % LAT_TRACE_BUFFER_SIZE];
+}
+
+#else
+
+void lat_trace_start(void) {}
+void lat_trace_stop(void) {}
+
+static uint32_t available(uint32_t core) {
+  return 0;
+}
+
+static const lat_trace_event_t* event_at(uint32_t core, uint32_t index) {
+  return NULL;
+}
+
+#endif // LAT_TRACE
+
+uint32_t lat_trace_events(uint32_t core, lat_trace_event_t* events,
+                          uint32_t max_events) {
+  if (core >= LAT_TRACE_MAX_CORES)
+    return 0;
+
+  uint32_t count = available(core);
+  if (count > max_events)
+    count = max_events;
+
+  for (uint i=0; i<count; i++)
+    events[i] = *event_at(core, i);
+
+  return count;
+}
+
+void lat_trace_dump_chrome(FILE* stream) {
+  int first = 1;
+
+  fprintf(stream, "{\"traceEvents\": [");
+
+  for (uint core=0; core<LAT_TRACE_MAX_CORES; core++) {
+    for (uint i=0; i<available(core); i++) {
+      const lat_trace_event_t* e = event_at(core, i);
+      fprintf(stream, "%s\n  {\"name\": \"%s\", \"ph\": \"X\", "
+              "\"ts\": %" PRIu64 ", \"dur\": %" PRIu64 ", \"pid\": 0, "
+              "\"tid\": %" PRIu32 ", \"args\": {\"macs\": %" PRIu64 ", "
+              "\"bytes\": %" PRIu64 "}}",
+              first ? "" : ",", lat_trace_event_name(e->event), e->start,
+              e->end - e->start, e->core, e->macs, e->bytes);
+      first = 0;
+    }
+  }
+
+  fprintf(stream, "\n]}\n");
+}
+
+void lat_trace_dump_summary(FILE* stream) {
+  uint64_t count[TRACE_EVENT_COUNT] = {0};
+  uint64_t cycles[TRACE_EVENT_COUNT] = {0};
+  uint64_t macs[TRACE_EVENT_COUNT] = {0};
+  uint64_t bytes[TRACE_EVENT_COUNT] = {0};
+
+  for (uint core=0; core<LAT_TRACE_MAX_CORES; core++) {
+    for (uint i=0; i<available(core); i++) {
+      const lat_trace_event_t* e = event_at(core, i);
+      count[e->event]++;
+      cycles[e->event] += e->end - e->start;
+      macs[e->event] += e->macs;
+      bytes[e->event] += e->bytes;
+    }
+  }
+
+  fprintf(stream, "%-12s %10s %14s %12s %14s %14s %10s\n", "event", "count",
+          "cycles", "mean", "macs", "bytes", "macs/cycle");
+
+  for (uint t=0; t<TRACE_EVENT_COUNT; t++) {
+    if (count[t] == 0)
+      continue;
+
+    fprintf(stream, "%-12s %10" PRIu64 " %14" PRIu64 " %12" PRIu64
+            " %14" PRIu64 " %14" PRIu64 " %10.3f\n",
+            lat_trace_event_name(t), count[t], cycles[t], cycles[t] / count[t],
+            macs[t], bytes[t],
+            (cycles[t] == 0) ? 0.0 : (double)macs[t] / cycles[t]);
+  }
+}
@@ -0,0 +1,318 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <lat/run.h>
+#include <loki/channels.h>
+#include <loki/ids.h>
+#include "nn/layers.h"
+#include "internal.h"
+
+// A transposed convolution scatters each input value, multiplied by the whole
+// filter, into the output: input position `i` and filter position `k`
+// contribute to output position `i * stride + k * dilation - padding`. This
+// is the input stationary formulation, with the output stepping by `stride`
+// in the image loops. Unlike an ordinary convolution on a zero-inserted
+// input, no multiplications by zero are done.
+
+// Output size of a transposed convolution in one dimension.
+static uint transpose_output_size(uint input_size, uint filter_size,
+                                  uint stride, uint dilation, uint padding) {
+  int32_t size = (int32_t)(input_size - 1) * stride +
+                 dilation * (filter_size - 1) + 1 - 2 * padding;
+  return (input_size == 0 || size < 0) ? 0 : size;
+}
+
+static inline uint transpose_output_height(const conv_shape_t* params) {
+  return transpose_output_size(params->image_height, params->filter_height,
+                               params->stride, params->dilation,
+                               params->padding_h);
+}
+
+static inline uint transpose_output_width(const conv_shape_t* params) {
+  return transpose_output_size(params->image_width, params->filter_width,
+                               params->stride, params->dilation,
+                               params->padding_w);
+}
+
+// How one spatial dimension is split into regions. Input positions whose
+// outputs are all inside the (cropped) output are computed together; each of
+// the others is computed separately, with only the part of the filter which
+// lands inside the output.
+typedef struct {
+  uint32_t output_size;
+  uint32_t filter_size;
+  uint32_t stride;
+  uint32_t dilation;
+  uint32_t padding;
+  uint32_t edge_before; // Input positions with outputs before the start
+  uint32_t interior;    // Input positions with all outputs inside
+  uint32_t edge_after;  // Input positions with outputs after the end
+} transpose_dim_t;
+
+static transpose_dim_t get_dim(uint32_t input_size, uint32_t output_size,
+                               uint32_t filter_size, uint32_t padding,
+                               const conv_shape_t* params) {
+  transpose_dim_t dim;
+  dim.output_size = output_size;
+  dim.filter_size = filter_size;
+  dim.stride = params->stride;
+  dim.dilation = params->dilation;
+  dim.padding = padding;
+
+  // Input positions [first_inside, end_inside) have all outputs inside.
+  uint32_t first_inside = (padding + params->stride - 1) / params->stride;
+  if (first_inside > input_size)
+    first_inside = input_size;
+
+  int32_t last_start = (int32_t)output_size - 1 + padding -
+                       params->dilation * (filter_size - 1);
+  uint32_t end_inside = first_inside;
+  if (last_start >= 0 && last_start / params->stride + 1 > first_inside)
+    end_inside = last_start / params->stride + 1;
+  if (end_inside > input_size)
+    end_inside = input_size;
+
+  dim.edge_before = first_inside;
+  dim.interior = end_inside - first_inside;
+  dim.edge_after = input_size - end_inside;
+
+  return dim;
+}
+
+static uint32_t num_regions(const transpose_dim_t* dim) {
+  return dim->edge_before + ((dim->interior > 0) ? 1 : 0) + dim->edge_after;
+}
+
+// Find the input positions, filter positions and first output position of
+// one region. Returns 0 if the region contributes nothing to the output.
+static int select_region(const transpose_dim_t* dim, uint32_t region,
+                         uint32_t* input_first, uint32_t* input_count,
+                         uint32_t* filter_first, uint32_t* filter_count,
+                         uint32_t* output_first) {
+  uint32_t has_interior = (dim->interior > 0) ? 1 : 0;
+
+  if (region < dim->edge_before) {
+    *input_first = region;
+    *input_count = 1;
+  }
+  else if (region < dim->edge_before + has_interior) {
+    *input_first = dim->edge_before;
+    *input_count = dim->interior;
+  }
+  else {
+    *input_first = dim->interior + region - has_interior;
+    *input_count = 1;
+  }
+
+  // Output position (possibly cropped) of the first filter element.
+  int32_t start = (int32_t)(*input_first * dim->stride) - dim->padding;
+
+  // Range of filter elements which land inside the output.
+  uint32_t first = 0;
+  if (start < 0)
+    first = (-start + dim->dilation - 1) / dim->dilation;
+
+  int32_t last = (int32_t)dim->output_size - 1 - start;
+  uint32_t end = 0;
+  if (last >= 0)
+    end = last / dim->dilation + 1;
+  if (end > dim->filter_size)
+    end = dim->filter_size;
+
+  if (end <= first)
+    return 0;
+
+  *filter_first = first;
+  *filter_count = end - first;
+  *output_first = start + first * dim->dilation;
+  return 1;
+}
+
+void lat_conv_transpose2d(
+  const activation_config_t* input,
+  const filter_config_t* weights,
+  activation_config_t* output,
+  const conv_shape_t* params,
+  const loop_nest_t* loop_order
+) {
+  if (loop_order == NULL)
+    loop_order = &LOOP_NEST_INPUT_STATIONARY;
+
+  const uint out_height = transpose_output_height(params);
+  const uint out_width = transpose_output_width(params);
+  if (out_height == 0 || out_width == 0)
+    return;
+
+  TRACE_BEGIN(start);
+
+  int first_loop = needs_group_loop(loop_order, params);
+  uint loop_count = conv_loop_count(loop_order, params);
+  loop_iteration_t loops[loop_count];
+  uint32_t iteration_counts[loop_count];
+
+  lat_parameters_t p;
+  uint32_t this_core = single_core_bitmask(get_core_id());
+  p.notification_address = loki_mcast_address(this_core, CH_REGISTER_3, 0);
+  p.loop_count = loop_count;
+  p.loops = loops;
+  p.iteration_counts = iteration_counts;
+
+  int image_row = -1, image_col = -1, filter_row = -1, filter_col = -1;
+
+  for (uint i=0; i<loop_count; i++) {
+    enum Loop loop = (i < first_loop) ? GROUPS
+                                      : loop_order->loops[i - first_loop];
+
+    switch (loop) {
+      case BATCH:
+        loops[i].in1_stride = input->batch_stride;
+        loops[i].in2_stride = 0;
+        loops[i].out_stride = output->batch_stride;
+        iteration_counts[i] = params->batch_size;
+        break;
+
+      case IN_CHANNELS:
+        loops[i].in1_stride = input->channel_stride;
+        loops[i].in2_stride = weights->in_channel_stride;
+        loops[i].out_stride = 0;
+        iteration_counts[i] = in_channels_per_group(params);
+        break;
+
+      case OUT_CHANNELS:
+        loops[i].in1_stride = 0;
+        loops[i].in2_stride = weights->out_channel_stride;
+        loops[i].out_stride = output->channel_stride;
+        iteration_counts[i] = out_channels_per_group(params);
+        break;
+
+      case IMAGE_WIDTH:
+        loops[i].in1_stride = input->column_stride;
+        loops[i].in2_stride = 0;
+        loops[i].out_stride = output->column_stride * params->stride;
+        image_col = i;
+        break;
+
+      case IMAGE_HEIGHT:
+        loops[i].in1_stride = input->row_stride;
+        loops[i].in2_stride = 0;
+        loops[i].out_stride = output->row_stride * params->stride;
+        image_row = i;
+        break;
+
+      case FILTER_WIDTH_IS:
+        loops[i].in1_stride = 0;
+        loops[i].in2_stride = weights->column_stride;
+        loops[i].out_stride = output->column_stride * params->dilation;
+        filter_col = i;
+        break;
+
+      case FILTER_HEIGHT_IS:
+        loops[i].in1_stride = 0;
+        loops[i].in2_stride = weights->row_stride;
+        loops[i].out_stride = output->row_stride * params->dilation;
+        filter_row = i;
+        break;
+
+      case GROUPS:
+        loops[i].in1_stride =
+            input->channel_stride * in_channels_per_group(params);
+        loops[i].in2_stride = weights->group_stride;
+        loops[i].out_stride =
+            output->channel_stride * out_channels_per_group(params);
+        iteration_counts[i] = conv_groups(params);
+        break;
+
+      default:
+        printf("Error: unsupported transposed convolution Loop enum: %d\n",
+               loop);
+        exit(1);
+        break;
+    }
+  }
+
+  if ((image_row < 0 && params->image_height > 1) ||
+      (image_col < 0 && params->image_width > 1) ||
+      (filter_row < 0 && params->filter_height > 1) ||
+      (filter_col < 0 && params->filter_width > 1)) {
+    printf("Error: transposed convolution needs IMAGE_* and FILTER_*_IS "
+           "loops\n");
+    exit(1);
+  }
+
+  transpose_dim_t rows = get_dim(params->image_height, out_height,
+                                 params->filter_height, params->padding_h,
+                                 params);
+  transpose_dim_t columns = get_dim(params->image_width, out_width,
+                                    params->filter_width, params->padding_w,
+                                    params);
+
+  for (uint r=0; r<num_regions(&rows); r++) {
+    uint32_t row_in, row_count, row_filter, row_filter_count, row_out;
+    if (!select_region(&rows, r, &row_in, &row_count, &row_filter,
+                       &row_filter_count, &row_out))
+      continue;
+
+    for (uint c=0; c<num_regions(&columns); c++) {
+      uint32_t col_in, col_count, col_filter, col_filter_count, col_out;
+      if (!select_region(&columns, c, &col_in, &col_count, &col_filter,
+                         &col_filter_count, &col_out))
+        continue;
+
+      if (image_row >= 0)
+        iteration_counts[image_row] = row_count;
+      if (image_col >= 0)
+        iteration_counts[image_col] = col_count;
+      if (filter_row >= 0)
+        iteration_counts[filter_row] = row_filter_count;
+      if (filter_col >= 0)
+        iteration_counts[filter_col] = col_filter_count;
+
+      p.in1 = offset_location(input->data, row_in * input->row_stride +
+                                           col_in * input->column_stride);
+      p.in2 = offset_location(weights->data,
+                              row_filter * weights->row_stride +
+                              col_filter * weights->column_stride);
+      p.out = offset_location(output->data, row_out * output->row_stride +
+                                            col_out * output->column_stride);
+
+      accelerate_and_wait(&p);
+    }
+  }
+
+  // Multiplies which land in cropped padding are skipped, so this is an upper
+  // bound.
+  TRACE_END(start, TRACE_CONV2D,
+            (uint64_t)params->batch_size * params->in_channels *
+            out_channels_per_group(params) * params->image_height *
+            params->image_width * params->filter_height *
+            params->filter_width, 0);
+}
+
+activation_config_t* lat_conv_transpose2d_alloc(
+  const activation_config_t* input,
+  const filter_config_t* weights,
+  const conv_shape_t* params,
+  const loop_nest_t* loop_order,
+  lat_arena_t* arena
+) {
+  uint batch = params->batch_size;
+  uint channels = params->out_channels;
+  uint height = transpose_output_height(params);
+  uint width = transpose_output_width(params);
+
+  activation_config_t* output =
+      init_activation_tensor(batch, channels, height, width, arena);
+
+  // Default: use same memory group as `input`.
+  if (arena == NULL)
+    output->data.memory_config = input->data.memory_config;
+
+  // Each output is reached by several launches, so can't be overwritten.
+  clear_memory(output->data.address,
+               (size_t)batch * channels * height * width * sizeof(data_t) / 4,
+               output->data.memory_config);
+
+  lat_conv_transpose2d(input, weights, output, params, loop_order);
+
+  return output;
+}
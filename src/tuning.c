@@ -0,0 +1,272 @@
+#include <stdio.h>
+#include <string.h>
+#include "nn/tuning.h"
+#include "internal.h"
+
+// Relative costs used by the model.
+#define CYCLES_PER_WORD         1  // Memory access (per word, not per byte)
+#define CYCLES_PER_INNER_LOOP   8  // Sequencing overhead per inner loop launch
+
+typedef struct {
+  const char* name;
+  loop_nest_t* nest;
+} named_nest_t;
+
+// Loop nests which can be chosen automatically. These all give identical
+// results for any shape and tensor layout.
+static const named_nest_t candidates[] = {
+  {"output_stationary", &LOOP_NEST_OUTPUT_STATIONARY},
+  {"weight_stationary", &LOOP_NEST_WEIGHT_STATIONARY},
+  {"naive",             &LOOP_NEST_NAIVE},
+};
+#define NUM_CANDIDATES (sizeof(candidates) / sizeof(named_nest_t))
+
+typedef struct {
+  conv_shape_t shape;
+  const loop_nest_t* nest;
+} cache_entry_t;
+
+// Memory allocation is not multi-tile safe, so use a statically allocated
+// table. Entries are not protected against concurrent updates from multiple
+// tiles.
+static cache_entry_t cache[LAT_LOOP_NEST_CACHE_SIZE];
+static uint cache_entries = 0;
+
+// Which operands' addresses change when the given loop advances.
+enum {
+  USES_INPUT = 1,
+  USES_WEIGHTS = 2,
+  USES_OUTPUT = 4
+};
+
+static uint operands_used(enum Loop loop) {
+  switch (loop) {
+    case BATCH:
+    case IMAGE_WIDTH:
+    case IMAGE_HEIGHT:
+      return USES_INPUT | USES_OUTPUT;
+    case IN_CHANNELS:
+    case IN_CHANNEL_TILES:
+    case FILTER_WIDTH_OS:
+    case FILTER_HEIGHT_OS:
+      return USES_INPUT | USES_WEIGHTS;
+    case OUT_CHANNELS:
+    case OUT_CHANNEL_TILES:
+      return USES_WEIGHTS | USES_OUTPUT;
+    case FILTER_WIDTH_IS:
+    case FILTER_HEIGHT_IS:
+      return USES_WEIGHTS | USES_OUTPUT;
+    case GROUPS:
+    default:
+      return USES_INPUT | USES_WEIGHTS | USES_OUTPUT;
+  }
+}
+
+// Fraction of `size` processing elements which do useful work when `count`
+// iterations are spread across them.
+static float utilisation(uint32_t count, uint32_t size) {
+  uint32_t passes = (count + size - 1) / size;
+  return (float)count / (passes * size);
+}
+
+// Number of words of an operand fetched from memory. A value is assumed to
+// stay local while only loops which don't use it are iterating, so the
+// operand is refetched once per iteration of every loop outside (and
+// including) the innermost loop which uses it.
+static float operand_traffic(const conv_shape_t* shape,
+                             const loop_nest_t* nest, uint operand) {
+  float words = 1;
+  int innermost = -1;
+
+  for (uint i=0; i<nest->loop_count; i++)
+    if (operands_used(nest->loops[i]) & operand)
+      innermost = i;
+
+  for (int i=0; i<=innermost; i++)
+    words *= loop_iteration_count(nest, nest->loops[i], shape);
+
+  // An implicit GROUPS loop is outermost and uses all operands.
+  if (needs_group_loop(nest, shape))
+    words *= conv_groups(shape);
+
+  return words;
+}
+
+uint64_t lat_loop_nest_traffic(const conv_shape_t* shape,
+                               const loop_nest_t* nest) {
+  // Outputs are accumulated in memory, so are both read and written.
+  float words = operand_traffic(shape, nest, USES_INPUT) +
+                operand_traffic(shape, nest, USES_WEIGHTS) +
+                2 * operand_traffic(shape, nest, USES_OUTPUT);
+
+  return (uint64_t)words * sizeof(data_t);
+}
+
+uint32_t lat_loop_nest_cost(const conv_shape_t* shape,
+                            const loop_nest_t* nest) {
+  float macs = 1;
+  for (uint i=0; i<nest->loop_count; i++)
+    macs *= loop_iteration_count(nest, nest->loops[i], shape);
+  if (needs_group_loop(nest, shape))
+    macs *= conv_groups(shape);
+
+  if (macs == 0)
+    return 0;
+
+  // The innermost loop is spread across the columns of the accelerator, and
+  // the next loop across its rows.
+  float util = 1;
+  float inner_launches = macs;
+  if (nest->loop_count >= 1) {
+    enum Loop loop = nest->loops[nest->loop_count-1];
+    uint32_t count = loop_iteration_count(nest, loop, shape);
+    util *= utilisation(count, LAT_ACCELERATOR_COLUMNS);
+    inner_launches /= count;
+  }
+  if (nest->loop_count >= 2) {
+    enum Loop loop = nest->loops[nest->loop_count-2];
+    uint32_t count = loop_iteration_count(nest, loop, shape);
+    util *= utilisation(count, LAT_ACCELERATOR_ROWS);
+  }
+
+  float compute = macs /
+      (LAT_ACCELERATOR_ROWS * LAT_ACCELERATOR_COLUMNS * util);
+
+  float memory = (float)lat_loop_nest_traffic(shape, nest) / sizeof(data_t);
+
+  float cost = compute + memory * CYCLES_PER_WORD +
+               inner_launches * CYCLES_PER_INNER_LOOP;
+
+  return (cost > (float)UINT32_MAX) ? UINT32_MAX : (uint32_t)cost;
+}
+
+static int same_shape(const conv_shape_t* a, const conv_shape_t* b) {
+  return a->batch_size == b->batch_size &&
+         a->in_channels == b->in_channels &&
+         a->out_channels == b->out_channels &&
+         a->image_width == b->image_width &&
+         a->image_height == b->image_height &&
+         a->filter_width == b->filter_width &&
+         a->filter_height == b->filter_height &&
+         a->groups == b->groups &&
+         a->stride == b->stride &&
+         a->dilation == b->dilation &&
+         a->padding_h == b->padding_h &&
+         a->padding_w == b->padding_w;
+}
+
+static const loop_nest_t* cache_lookup(const conv_shape_t* shape) {
+  for (uint i=0; i<cache_entries; i++)
+    if (same_shape(&cache[i].shape, shape))
+      return cache[i].nest;
+
+  return NULL;
+}
+
+void lat_loop_nest_cache_insert(const conv_shape_t* shape,
+                                const loop_nest_t* nest) {
+  for (uint i=0; i<cache_entries; i++) {
+    if (same_shape(&cache[i].shape, shape)) {
+      cache[i].nest = nest;
+      return;
+    }
+  }
+
+  // When full, forget the oldest entry.
+  if (cache_entries == LAT_LOOP_NEST_CACHE_SIZE) {
+    memmove(cache, cache + 1,
+            (LAT_LOOP_NEST_CACHE_SIZE - 1) * sizeof(cache_entry_t));
+    cache_entries--;
+  }
+
+  cache[cache_entries].shape = *shape;
+  cache[cache_entries].nest = nest;
+  cache_entries++;
+}
+
+void lat_loop_nest_cache_clear(void) {
+  cache_entries = 0;
+}
+
+const loop_nest_t* lat_choose_loop_nest(const conv_shape_t* shape) {
+  const loop_nest_t* nest = cache_lookup(shape);
+  if (nest != NULL)
+    return nest;
+
+  uint32_t best_cost = UINT32_MAX;
+  for (uint i=0; i<NUM_CANDIDATES; i++) {
+    uint32_t cost = lat_loop_nest_cost(shape, candidates[i].nest);
+    if (nest == NULL || cost < best_cost) {
+      nest = candidates[i].nest;
+      best_cost = cost;
+    }
+  }
+
+  lat_loop_nest_cache_insert(shape, nest);
+  return nest;
+}
+
+// All predefined nests may be stored in the file, including those which are
+// never chosen automatically.
+static const named_nest_t all_nests[] = {
+  {"naive",             &LOOP_NEST_NAIVE},
+  {"output_stationary", &LOOP_NEST_OUTPUT_STATIONARY},
+  {"input_stationary",  &LOOP_NEST_INPUT_STATIONARY},
+  {"weight_stationary", &LOOP_NEST_WEIGHT_STATIONARY},
+};
+#define NUM_NESTS (sizeof(all_nests) / sizeof(named_nest_t))
+
+// File format: one line per shape.
+// batch in_channels out_channels width height filter_width filter_height
+//   groups stride dilation padding_h padding_w nest_name
+int lat_loop_nest_cache_load(const char* filename) {
+  FILE* file = fopen(filename, "r");
+  if (file == NULL)
+    return -1;
+
+  conv_shape_t shape;
+  char name[32];
+  while (fscanf(file, "%u %u %u %u %u %u %u %u %u %u %u %u %31s",
+                &shape.batch_size, &shape.in_channels, &shape.out_channels,
+                &shape.image_width, &shape.image_height, &shape.filter_width,
+                &shape.filter_height, &shape.groups, &shape.stride,
+                &shape.dilation, &shape.padding_h, &shape.padding_w,
+                name) == 13) {
+    for (uint i=0; i<NUM_NESTS; i++) {
+      if (strcmp(name, all_nests[i].name) == 0) {
+        lat_loop_nest_cache_insert(&shape, all_nests[i].nest);
+        break;
+      }
+    }
+  }
+
+  fclose(file);
+  return 0;
+}
+
+int lat_loop_nest_cache_save(const char* filename) {
+  FILE* file = fopen(filename, "w");
+  if (file == NULL)
+    return -1;
+
+  for (uint i=0; i<cache_entries; i++) {
+    const conv_shape_t* shape = &cache[i].shape;
+
+    // Custom loop nests can't be stored.
+    const char* name = NULL;
+    for (uint j=0; j<NUM_NESTS; j++)
+      if (cache[i].nest == all_nests[j].nest)
+        name = all_nests[j].name;
+    if (name == NULL)
+      continue;
+
+    fprintf(file, "%u %u %u %u %u %u %u %u %u %u %u %u %s\n",
+            shape->batch_size, shape->in_channels, shape->out_channels,
+            shape->image_width, shape->image_height, shape->filter_width,
+            shape->filter_height, shape->groups, shape->stride,
+            shape->dilation, shape->padding_h, shape->padding_w, name);
+  }
+
+  fclose(file);
+  return 0;
+}
@@ -0,0 +1,362 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <loki/alloc.h>
+#include "nn/winograd.h"
+#include "internal.h"
+
+// Largest input tile, (m+2) for F(4x4,3x3).
+#define MAX_TILE 6
+
+// Matrices for F(m x m, 3 x 3), from Lavin and Gray, "Fast Algorithms for
+// Convolutional Neural Networks". G is multiplied by `scale` to make it an
+// integer matrix, so the transformed filter is scale^2 times too large.
+typedef struct {
+  uint32_t output_tile;               // m
+  uint32_t input_tile;                // m + 2
+  int32_t  scale;
+  int32_t  BT[MAX_TILE][MAX_TILE];    // input_tile x input_tile
+  int32_t  G[MAX_TILE][3];            // input_tile x 3
+  int32_t  AT[MAX_TILE - 2][MAX_TILE];  // output_tile x input_tile
+} transform_t;
+
+static const transform_t F2X2_3X3 = {
+  2, 4, 2,
+  {{1,  0, -1,  0},
+   {0,  1,  1,  0},
+   {0, -1,  1,  0},
+   {0,  1,  0, -1}},
+  {{2,  0,  0},
+   {1,  1,  1},
+   {1, -1,  1},
+   {0,  0,  2}},
+  {{1,  1,  1,  0},
+   {0,  1, -1, -1}}
+};
+
+static const transform_t F4X4_3X3 = {
+  4, 6, 24,
+  {{4,  0, -5,  0,  1,  0},
+   {0, -4, -4,  1,  1,  0},
+   {0,  4, -4, -1,  1,  0},
+   {0, -2, -1,  2,  1,  0},
+   {0,  2, -1, -2,  1,  0},
+   {0,  4,  0, -5,  0,  1}},
+  {{ 6,  0,  0},
+   {-4, -4, -4},
+   {-4,  4, -4},
+   { 1,  2,  4},
+   { 1, -2,  4},
+   { 0,  0, 24}},
+  {{1,  1,  1,  1,  1,  0},
+   {0,  1, -1,  2, -2,  0},
+   {0,  1,  1,  4,  4,  0},
+   {0,  1, -1,  8, -8,  1}}
+};
+
+static const transform_t* get_transform(enum Winograd variant) {
+  switch (variant) {
+    case WINOGRAD_F2X2_3X3:
+      return &F2X2_3X3;
+    case WINOGRAD_F4X4_3X3:
+      return &F4X4_3X3;
+    default:
+      printf("Error: unsupported Winograd enum: %d\n", variant);
+      exit(1);
+  }
+}
+
+static void check_shape(const conv_shape_t* params) {
+  if (params->filter_width != 3 || params->filter_height != 3 ||
+      params->stride != 1 || params->dilation != 1 ||
+      conv_groups(params) != 1) {
+    printf("Error: Winograd convolution needs a 3x3 filter with stride 1, "
+           "dilation 1 and no groups\n");
+    exit(1);
+  }
+}
+
+static inline data_t* element(const activation_config_t* tensor, uint b,
+                              uint ch, uint row, uint col) {
+  return tensor->data.address + (b*tensor->batch_stride +
+         ch*tensor->channel_stride + row*tensor->row_stride +
+         col*tensor->column_stride) / (int)sizeof(data_t);
+}
+
+lat_winograd_filter_t* lat_winograd_filter_create(
+  const filter_config_t* weights,
+  const conv_shape_t* params,
+  enum Winograd variant
+) {
+  check_shape(params);
+  const transform_t* t = get_transform(variant);
+  const uint a = t->input_tile;
+  const uint32_t in_channels = params->in_channels;
+  const uint32_t out_channels = params->out_channels;
+
+  lat_winograd_filter_t* filter = loki_malloc(sizeof(lat_winograd_filter_t));
+  if (filter == NULL)
+    return NULL;
+
+  size_t words = (size_t)a * a * out_channels * in_channels;
+  data_t* data = loki_malloc(words * sizeof(data_t));
+  if (data == NULL) {
+    loki_free(filter);
+    return NULL;
+  }
+
+  filter->variant = variant;
+  filter->in_channels = in_channels;
+  filter->out_channels = out_channels;
+  filter->weights.data.address = data;
+  filter->weights.data.memory_config = weights->data.memory_config;
+  filter->weights.in_channel_stride = sizeof(data_t);
+  filter->weights.out_channel_stride = in_channels * sizeof(data_t);
+  filter->weights.group_stride = out_channels * in_channels * sizeof(data_t);
+  filter->weights.row_stride = 0;
+  filter->weights.column_stride = 0;
+
+  for (uint k=0; k<out_channels; k++) {
+    for (uint c=0; c<in_channels; c++) {
+      const data_t* g = weights->data.address +
+          (k * weights->out_channel_stride + c * weights->in_channel_stride) /
+          (int)sizeof(data_t);
+      int row_step = weights->row_stride / (int)sizeof(data_t);
+      int col_step = weights->column_stride / (int)sizeof(data_t);
+
+      // U = G g G^T
+      data_t temp[MAX_TILE][3];
+      for (uint i=0; i<a; i++)
+        for (uint j=0; j<3; j++)
+          temp[i][j] = t->G[i][0] * g[j * col_step] +
+                       t->G[i][1] * g[row_step + j * col_step] +
+                       t->G[i][2] * g[2 * row_step + j * col_step];
+
+      for (uint i=0; i<a; i++) {
+        for (uint j=0; j<a; j++) {
+          data_t value = temp[i][0] * t->G[j][0] + temp[i][1] * t->G[j][1] +
+                         temp[i][2] * t->G[j][2];
+          data[((i * a + j) * out_channels + k) * in_channels + c] = value;
+        }
+      }
+    }
+  }
+
+  return filter;
+}
+
+void lat_winograd_filter_destroy(lat_winograd_filter_t* filter) {
+  loki_free(filter->weights.data.address);
+  loki_free(filter);
+}
+
+// V = B^T d B for every tile and channel of one image. `transformed` has
+// layout [tile][position][channel].
+static void transform_input(const transform_t* t,
+                            const activation_config_t* input,
+                            const conv_shape_t* params, uint b,
+                            uint tiles_h, uint tiles_w, data_t* transformed) {
+  const uint a = t->input_tile;
+  const uint32_t channels = params->in_channels;
+
+  for (uint ty=0; ty<tiles_h; ty++) {
+    for (uint tx=0; tx<tiles_w; tx++) {
+      data_t* tile_out = transformed +
+          (size_t)(ty * tiles_w + tx) * a * a * channels;
+
+      int32_t top = (int32_t)(ty * t->output_tile) - params->padding_h;
+      int32_t left = (int32_t)(tx * t->output_tile) - params->padding_w;
+
+      for (uint c=0; c<channels; c++) {
+        // Gather the tile, with zeros for anything outside the input.
+        data_t d[MAX_TILE][MAX_TILE];
+        for (uint i=0; i<a; i++) {
+          int32_t row = top + i;
+          for (uint j=0; j<a; j++) {
+            int32_t col = left + j;
+            d[i][j] = (row >= 0 && row < params->image_height &&
+                       col >= 0 && col < params->image_width)
+                    ? *element(input, b, c, row, col) : 0;
+          }
+        }
+
+        data_t temp[MAX_TILE][MAX_TILE];
+        for (uint i=0; i<a; i++) {
+          for (uint j=0; j<a; j++) {
+            data_t sum = 0;
+            for (uint k=0; k<a; k++)
+              sum += t->BT[i][k] * d[k][j];
+            temp[i][j] = sum;
+          }
+        }
+
+        for (uint i=0; i<a; i++) {
+          for (uint j=0; j<a; j++) {
+            data_t sum = 0;
+            for (uint k=0; k<a; k++)
+              sum += temp[i][k] * t->BT[j][k];
+            tile_out[(i * a + j) * channels + c] = sum;
+          }
+        }
+      }
+    }
+  }
+}
+
+// Y = A^T M A for every tile and channel of one image, accumulated into the
+// output after removing the filter transform's scale. `products` has layout
+// [tile][position][channel].
+static void transform_output(const transform_t* t, const data_t* products,
+                             activation_config_t* output,
+                             const conv_shape_t* params, uint b,
+                             uint tiles_h, uint tiles_w) {
+  const uint a = t->input_tile;
+  const uint m = t->output_tile;
+  const uint32_t channels = params->out_channels;
+  const uint out_height = conv_output_height(params);
+  const uint out_width = conv_output_width(params);
+  const data_t scale = t->scale * t->scale;
+
+  // Loki has no division unit. The scale is a power of two for F(2x2,3x3), so
+  // a shift is enough; otherwise multiply by a reciprocal.
+  uint32_t shift = 0;
+  while ((1 << shift) < scale)
+    shift++;
+  const int power_of_two = (1 << shift) == scale;
+  const reciprocal_t reciprocal = make_reciprocal(scale);
+
+  for (uint ty=0; ty<tiles_h; ty++) {
+    for (uint tx=0; tx<tiles_w; tx++) {
+      const data_t* tile_in = products +
+          (size_t)(ty * tiles_w + tx) * a * a * channels;
+
+      // Partial tiles at the bottom/right edges.
+      uint rows = out_height - ty * m;
+      uint cols = out_width - tx * m;
+      if (rows > m)
+        rows = m;
+      if (cols > m)
+        cols = m;
+
+      for (uint k=0; k<channels; k++) {
+        data_t temp[MAX_TILE - 2][MAX_TILE];
+        for (uint i=0; i<m; i++) {
+          for (uint j=0; j<a; j++) {
+            data_t sum = 0;
+            for (uint l=0; l<a; l++)
+              sum += t->AT[i][l] * tile_in[(l * a + j) * channels + k];
+            temp[i][j] = sum;
+          }
+        }
+
+        for (uint i=0; i<rows; i++) {
+          for (uint j=0; j<cols; j++) {
+            data_t sum = 0;
+            for (uint l=0; l<a; l++)
+              sum += temp[i][l] * t->AT[j][l];
+
+            // Exact: the true result is an integer, so `sum` is a multiple of
+            // `scale`.
+            *element(output, b, k, ty * m + i, tx * m + j) +=
+                power_of_two ? (sum >> shift) : divide(sum, &reciprocal);
+          }
+        }
+      }
+    }
+  }
+}
+
+void lat_conv2d_winograd(
+  const activation_config_t* input,
+  const lat_winograd_filter_t* weights,
+  activation_config_t* output,
+  const conv_shape_t* params,
+  const loop_nest_t* loop_order,
+  lat_arena_t* arena
+) {
+  check_shape(params);
+  assert(weights->in_channels == params->in_channels);
+  assert(weights->out_channels == params->out_channels);
+
+  const transform_t* t = get_transform(weights->variant);
+  const uint a = t->input_tile;
+  const uint positions = a * a;
+  const uint tiles_h =
+      (conv_output_height(params) + t->output_tile - 1) / t->output_tile;
+  const uint tiles_w =
+      (conv_output_width(params) + t->output_tile - 1) / t->output_tile;
+  const uint tiles = tiles_h * tiles_w;
+
+  if (tiles == 0 || params->batch_size == 0)
+    return;
+
+  // The multiplication for one image: each tile position is a group, with a
+  // 1x1 convolution over all tiles (as the batch).
+  conv_shape_t products;
+  linear_shape(&products, tiles, positions * params->in_channels,
+               positions * params->out_channels);
+  products.groups = positions;
+
+  // Double buffer everything so the core can transform one image while the
+  // accelerator multiplies the next.
+  size_t in_words = (size_t)tiles * positions * params->in_channels;
+  size_t out_words = (size_t)tiles * positions * params->out_channels;
+  data_t* buffers[2][2];
+  for (uint i=0; i<2; i++) {
+    buffers[i][0] = allocate(arena, in_words * sizeof(data_t));
+    buffers[i][1] = allocate(arena, out_words * sizeof(data_t));
+    assert(buffers[i][0] != NULL && buffers[i][1] != NULL);
+  }
+
+  activation_config_t transformed[2], multiplied[2];
+  for (uint i=0; i<2; i++) {
+    transformed[i].data.address = buffers[i][0];
+    transformed[i].data.memory_config = input->data.memory_config;
+    set_default_strides(&transformed[i], positions * params->in_channels, 1, 1);
+
+    multiplied[i].data.address = buffers[i][1];
+    multiplied[i].data.memory_config = output->data.memory_config;
+    set_default_strides(&multiplied[i], positions * params->out_channels, 1, 1);
+  }
+
+  lat_handle_t handle;
+
+  // Products are accumulated, so must start at zero. After the first two
+  // images, each buffer is cleared as soon as its results have been
+  // transformed, while the accelerator is busy.
+  for (uint i=0; i<2 && i<params->batch_size; i++)
+    clear_memory(buffers[i][1], out_words * sizeof(data_t) / 4,
+                 output->data.memory_config);
+
+  for (uint b=0; b<params->batch_size; b++) {
+    uint current = b % 2;
+    transform_input(t, input, params, b, tiles_h, tiles_w,
+                    buffers[current][0]);
+
+    if (b > 0)
+      lat_wait(&handle);
+
+    lat_conv2d_async(&transformed[current], &weights->weights,
+                     &multiplied[current], &products, loop_order, &handle);
+
+    if (b > 0) {
+      transform_output(t, buffers[1 - current][1], output, params, b - 1,
+                       tiles_h, tiles_w);
+
+      if (b + 1 < params->batch_size)
+        clear_memory(buffers[1 - current][1], out_words * sizeof(data_t) / 4,
+                     output->data.memory_config);
+    }
+  }
+
+  lat_wait(&handle);
+  transform_output(t, buffers[(params->batch_size - 1) % 2][1], output, params,
+                   params->batch_size - 1, tiles_h, tiles_w);
+
+  if (arena == NULL) {
+    for (uint i=0; i<2; i++) {
+      loki_free(buffers[i][0]);
+      loki_free(buffers[i][1]);
+    }
+  }
+}
@@ -0,0 +1,702 @@
+// Correctness tests, run on the host by `make test`. Each layer is computed
+// through every supported path (loop nests, tiling, padding, groups,
+// overwriting, packing, plans, multiple tiles and cores, and the alternative
+// algorithms) and compared with a naive reference. One line is printed per
+// test, and the exit status is nonzero if any fail.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "nn/layers.h"
+#include "nn/loops.h"
+#include "nn/quantized.h"
+#include "nn/sparse.h"
+#include "nn/winograd.h"
+
+static int failures = 0;
+
+static void report(const char* name, int errors) {
+  printf("%-40s %s\n", name, errors ? "FAIL" : "ok");
+  if (errors)
+    failures++;
+}
+
+static data_t* allocate_data(size_t words) {
+  data_t* data = malloc(words * sizeof(data_t) + 1);
+  if (data == NULL) {
+    fprintf(stderr, "Error: out of memory\n");
+    exit(1);
+  }
+
+  for (size_t i=0; i<words; i++)
+    data[i] = (rand() % 7) - 3;
+
+  return data;
+}
+
+// Activations in the default order: [batch, channels, height, width].
+static activation_config_t make_activations(data_t* data, uint32_t channels,
+                                            uint32_t height, uint32_t width) {
+  activation_config_t tensor;
+  tensor.data.address = data;
+  tensor.data.memory_config = 0;
+  tensor.column_stride = sizeof(data_t);
+  tensor.row_stride = width * tensor.column_stride;
+  tensor.channel_stride = height * tensor.row_stride;
+  tensor.batch_stride = channels * tensor.channel_stride;
+  return tensor;
+}
+
+// Weights in the default order: [out channels, in channels per group, height,
+// width].
+static filter_config_t make_weights(data_t* data, const conv_shape_t* shape) {
+  uint32_t groups = shape->groups ? shape->groups : 1;
+  filter_config_t weights;
+  weights.data.address = data;
+  weights.data.memory_config = 0;
+  weights.column_stride = sizeof(data_t);
+  weights.row_stride = shape->filter_width * weights.column_stride;
+  weights.in_channel_stride = shape->filter_height * weights.row_stride;
+  weights.out_channel_stride = (shape->in_channels / groups) *
+                               weights.in_channel_stride;
+  weights.group_stride = (shape->out_channels / groups) *
+                         weights.out_channel_stride;
+  return weights;
+}
+
+static uint32_t out_size(uint32_t input, uint32_t filter, uint32_t stride,
+                         uint32_t dilation, uint32_t padding) {
+  return (input + 2 * padding - dilation * (filter - 1) - 1) / stride + 1;
+}
+
+static uint32_t out_height(const conv_shape_t* s) {
+  return out_size(s->image_height, s->filter_height, s->stride, s->dilation,
+                  s->padding_h);
+}
+
+static uint32_t out_width(const conv_shape_t* s) {
+  return out_size(s->image_width, s->filter_width, s->stride, s->dilation,
+                  s->padding_w);
+}
+
+static size_t output_words(const conv_shape_t* s) {
+  return (size_t)s->batch_size * s->out_channels * out_height(s) *
+         out_width(s);
+}
+
+static void reference_conv(const data_t* in, const data_t* w, data_t* out,
+                           const conv_shape_t* s) {
+  uint32_t groups = s->groups ? s->groups : 1;
+  uint32_t ig = s->in_channels / groups, og = s->out_channels / groups;
+  uint32_t oh = out_height(s), ow = out_width(s);
+  size_t o = 0;
+
+  for (uint b=0; b<s->batch_size; b++)
+    for (uint k=0; k<s->out_channels; k++)
+      for (uint y=0; y<oh; y++)
+        for (uint x=0; x<ow; x++) {
+          data_t sum = 0;
+          for (uint c=0; c<ig; c++)
+            for (uint fy=0; fy<s->filter_height; fy++)
+              for (uint fx=0; fx<s->filter_width; fx++) {
+                int iy = y * s->stride + fy * s->dilation - s->padding_h;
+                int ix = x * s->stride + fx * s->dilation - s->padding_w;
+                if (iy < 0 || ix < 0 || iy >= s->image_height ||
+                    ix >= s->image_width)
+                  continue;
+                uint ic = (k / og) * ig + c;
+                sum += in[((b * s->in_channels + ic) * s->image_height + iy) *
+                          s->image_width + ix] *
+                       w[((k * ig + c) * s->filter_height + fy) *
+                         s->filter_width + fx];
+              }
+          out[o++] = sum;
+        }
+}
+
+static int compare(const data_t* a, const data_t* b, size_t words) {
+  int errors = 0;
+  for (size_t i=0; i<words; i++)
+    if (a[i] != b[i])
+      errors++;
+  return errors;
+}
+
+// batch, in, out, width, height, filter w/h, groups, stride, dilation,
+// padding h/w.
+static const conv_shape_t conv_shapes[] = {
+  {1,  3,  4,  7,  6, 3, 3, 1, 1, 1, 1, 1},
+  {2,  4,  4,  9,  8, 5, 3, 2, 2, 1, 2, 1},
+  {1,  2,  3,  6,  6, 3, 3, 1, 1, 2, 3, 3},
+  {2,  5,  7, 13, 11, 3, 3, 1, 1, 1, 0, 0},
+  {1, 16,  8,  9,  9, 3, 3, 1, 2, 1, 1, 1},
+  {3, 32, 20,  1,  1, 1, 1, 1, 1, 1, 0, 0},
+  {2, 12, 12, 10,  9, 3, 3, 12, 1, 1, 1, 1},
+  {1,  8, 12,  7,  7, 3, 3, 4, 2, 1, 0, 0},
+};
+#define NUM_CONV_SHAPES (sizeof(conv_shapes) / sizeof(conv_shape_t))
+
+// Channel tiles which don't divide the channel counts exactly.
+static enum Loop tiled_loops[] = {
+  OUT_CHANNEL_TILES, IN_CHANNEL_TILES, BATCH, OUT_CHANNELS, IMAGE_HEIGHT,
+  IMAGE_WIDTH, FILTER_HEIGHT_OS, FILTER_WIDTH_OS, IN_CHANNELS
+};
+static loop_nest_t tiled = {9, tiled_loops, 3, 2};
+
+typedef struct {
+  const char*        name;
+  const loop_nest_t* nest;
+} nest_option_t;
+
+static const nest_option_t nests[] = {
+  {"naive",             &LOOP_NEST_NAIVE},
+  {"output_stationary", &LOOP_NEST_OUTPUT_STATIONARY},
+  {"weight_stationary", &LOOP_NEST_WEIGHT_STATIONARY},
+  {"tiled",             &tiled},
+  {"auto",              NULL},
+};
+#define NUM_NESTS (sizeof(nests) / sizeof(nest_option_t))
+
+enum ConvPath {
+  PATH_CONV,
+  PATH_OVERWRITE,
+  PATH_PACKED,
+  PATH_ASYNC,
+  PATH_PLAN,
+  PATH_PARALLEL,
+  NUM_PATHS
+};
+
+static const char* path_names[NUM_PATHS] = {
+  "conv2d", "overwrite", "packed", "async", "plan", "parallel"
+};
+
+static int run_conv(const conv_shape_t* s, const loop_nest_t* nest,
+                    enum ConvPath path) {
+  uint32_t groups = s->groups ? s->groups : 1;
+  size_t in_words = (size_t)s->batch_size * s->in_channels * s->image_height *
+                    s->image_width;
+  size_t w_words = (size_t)s->out_channels * (s->in_channels / groups) *
+                   s->filter_height * s->filter_width;
+  size_t out_words = output_words(s);
+
+  data_t* in_data = allocate_data(in_words);
+  data_t* w_data = allocate_data(w_words);
+  data_t* out_data = allocate_data(out_words);
+  data_t* expected = allocate_data(out_words);
+
+  // Everything except the overwriting path accumulates.
+  if (path != PATH_OVERWRITE)
+    memset(out_data, 0, out_words * sizeof(data_t));
+
+  activation_config_t input = make_activations(in_data, s->in_channels,
+                                               s->image_height,
+                                               s->image_width);
+  activation_config_t output = make_activations(out_data, s->out_channels,
+                                                out_height(s), out_width(s));
+  filter_config_t weights = make_weights(w_data, s);
+
+  switch (path) {
+    case PATH_CONV:
+      lat_conv2d(&input, &weights, &output, s, nest);
+      break;
+
+    case PATH_OVERWRITE:
+      lat_conv2d_overwrite(&input, &weights, &output, s, nest);
+      break;
+
+    case PATH_PACKED: {
+      filter_config_t packed = lat_pack_weights(&weights, s, nest);
+      lat_conv2d(&input, &packed, &output, s, nest);
+      free(packed.data.address);
+      break;
+    }
+
+    case PATH_ASYNC: {
+      lat_handle_t handle;
+      lat_wait(lat_conv2d_async(&input, &weights, &output, s, nest, &handle));
+      break;
+    }
+
+    case PATH_PLAN: {
+      lat_plan_t* plan = lat_conv2d_plan_create(&input, &weights, s, nest);
+      lat_plan_execute(plan, in_data, out_data);
+      lat_plan_destroy(plan);
+      break;
+    }
+
+    case PATH_PARALLEL:
+      for (int partition=PARTITION_AUTO; partition<=PARTITION_ROWS;
+           partition++) {
+        memset(out_data, 0, out_words * sizeof(data_t));
+        lat_conv2d_parallel(&input, &weights, &output, s, nest, 3, partition);
+        reference_conv(in_data, w_data, expected, s);
+        if (compare(out_data, expected, out_words))
+          break;
+      }
+      break;
+
+    default:
+      break;
+  }
+
+  reference_conv(in_data, w_data, expected, s);
+  int errors = compare(out_data, expected, out_words);
+
+  free(in_data);
+  free(w_data);
+  free(out_data);
+  free(expected);
+  return errors;
+}
+
+static void test_conv(void) {
+  char name[64];
+
+  for (uint path=0; path<NUM_PATHS; path++) {
+    for (uint n=0; n<NUM_NESTS; n++) {
+      int errors = 0;
+      for (uint i=0; i<NUM_CONV_SHAPES; i++)
+        errors += run_conv(&conv_shapes[i], nests[n].nest, path);
+
+      snprintf(name, sizeof(name), "%s %s", path_names[path], nests[n].name);
+      report(name, errors);
+    }
+  }
+}
+
+static void test_fused(void) {
+  int errors = 0;
+
+  for (uint i=0; i<NUM_CONV_SHAPES; i++) {
+    const conv_shape_t* s = &conv_shapes[i];
+    uint32_t groups = s->groups ? s->groups : 1;
+    size_t in_words = (size_t)s->batch_size * s->in_channels *
+                      s->image_height * s->image_width;
+    size_t w_words = (size_t)s->out_channels * (s->in_channels / groups) *
+                     s->filter_height * s->filter_width;
+    size_t out_words = output_words(s);
+
+    data_t* in_data = allocate_data(in_words);
+    data_t* w_data = allocate_data(w_words);
+    data_t* bias = allocate_data(s->out_channels);
+    data_t* out_data = calloc(out_words, sizeof(data_t));
+    data_t* expected = allocate_data(out_words);
+
+    activation_config_t input = make_activations(in_data, s->in_channels,
+                                                 s->image_height,
+                                                 s->image_width);
+    activation_config_t output = make_activations(out_data, s->out_channels,
+                                                  out_height(s),
+                                                  out_width(s));
+    filter_config_t weights = make_weights(w_data, s);
+
+    epilogue_t epilogue;
+    memset(&epilogue, 0, sizeof(epilogue));
+    epilogue.bias = bias;
+    epilogue.activation = ACTIVATION_RELU;
+
+    lat_conv2d_fused(&input, &weights, &output, s, NULL, &epilogue);
+
+    reference_conv(in_data, w_data, expected, s);
+    size_t plane = (size_t)out_height(s) * out_width(s);
+    for (size_t j=0; j<out_words; j++) {
+      data_t value = expected[j] + bias[(j / plane) % s->out_channels];
+      expected[j] = (value < 0) ? 0 : value;
+    }
+    errors += compare(out_data, expected, out_words);
+
+    free(in_data);
+    free(w_data);
+    free(bias);
+    free(out_data);
+    free(expected);
+  }
+
+  report("fused bias+relu", errors);
+}
+
+static void test_sparse(void) {
+  int errors = 0;
+
+  for (uint i=0; i<NUM_CONV_SHAPES; i++) {
+    conv_shape_t s = conv_shapes[i];
+    if (s.groups > 1)
+      continue;
+
+    size_t in_words = (size_t)s.batch_size * s.in_channels * s.image_height *
+                      s.image_width;
+    size_t filter_words = (size_t)s.filter_height * s.filter_width;
+    size_t w_words = (size_t)s.out_channels * s.in_channels * filter_words;
+    size_t out_words = output_words(&s);
+
+    data_t* in_data = allocate_data(in_words);
+    data_t* w_data = allocate_data(w_words);
+    data_t* out_data = calloc(out_words, sizeof(data_t));
+    data_t* expected = allocate_data(out_words);
+
+    // Prune about half of the 2x2 channel blocks.
+    for (uint k=0; k<s.out_channels; k++)
+      for (uint c=0; c<s.in_channels; c++)
+        if (((k / 2) * 7 + (c / 2) * 3) % 2)
+          memset(&w_data[(k * s.in_channels + c) * filter_words], 0,
+                 filter_words * sizeof(data_t));
+
+    activation_config_t input = make_activations(in_data, s.in_channels,
+                                                 s.image_height,
+                                                 s.image_width);
+    activation_config_t output = make_activations(out_data, s.out_channels,
+                                                  out_height(&s),
+                                                  out_width(&s));
+    filter_config_t weights = make_weights(w_data, &s);
+
+    lat_sparse_filter_t* sparse = lat_sparse_filter_create(&weights, &s, 2, 2);
+    lat_conv2d_sparse(&input, sparse, &output, &s, NULL);
+    lat_sparse_filter_destroy(sparse);
+
+    reference_conv(in_data, w_data, expected, &s);
+    errors += compare(out_data, expected, out_words);
+
+    free(in_data);
+    free(w_data);
+    free(out_data);
+    free(expected);
+  }
+
+  report("sparse 2x2 blocks", errors);
+}
+
+static void test_winograd(void) {
+  // Only 3x3 filters with stride 1 and one group are supported.
+  static const conv_shape_t shapes[] = {
+    {1, 3, 10,  9, 7, 3, 3, 1, 1, 1, 1, 1},
+    {3, 4,  6,  8, 7, 3, 3, 1, 1, 1, 0, 0},
+    {2, 8,  5, 13, 11, 3, 3, 1, 1, 1, 1, 1},
+  };
+  static const enum Winograd variants[] = {
+    WINOGRAD_F2X2_3X3, WINOGRAD_F4X4_3X3
+  };
+
+  for (uint v=0; v<2; v++) {
+    int errors = 0;
+
+    for (uint i=0; i<sizeof(shapes)/sizeof(conv_shape_t); i++) {
+      const conv_shape_t* s = &shapes[i];
+      size_t in_words = (size_t)s->batch_size * s->in_channels *
+                        s->image_height * s->image_width;
+      size_t w_words = (size_t)s->out_channels * s->in_channels * 9;
+      size_t out_words = output_words(s);
+
+      data_t* in_data = allocate_data(in_words);
+      data_t* w_data = allocate_data(w_words);
+      data_t* out_data = calloc(out_words, sizeof(data_t));
+      data_t* expected = allocate_data(out_words);
+
+      activation_config_t input = make_activations(in_data, s->in_channels,
+                                                   s->image_height,
+                                                   s->image_width);
+      activation_config_t output = make_activations(out_data, s->out_channels,
+                                                    out_height(s),
+                                                    out_width(s));
+      filter_config_t weights = make_weights(w_data, s);
+
+      lat_winograd_filter_t* filter =
+          lat_winograd_filter_create(&weights, s, variants[v]);
+      lat_conv2d_winograd(&input, filter, &output, s, NULL, NULL);
+      lat_winograd_filter_destroy(filter);
+
+      reference_conv(in_data, w_data, expected, s);
+      errors += compare(out_data, expected, out_words);
+
+      free(in_data);
+      free(w_data);
+      free(out_data);
+      free(expected);
+    }
+
+    report(v ? "winograd F(4x4,3x3)" : "winograd F(2x2,3x3)", errors);
+  }
+}
+
+static uint32_t transpose_size(uint32_t input, uint32_t filter,
+                               uint32_t stride, uint32_t dilation,
+                               uint32_t padding) {
+  return (input - 1) * stride + dilation * (filter - 1) + 1 - 2 * padding;
+}
+
+static void test_transpose(void) {
+  static const conv_shape_t shapes[] = {
+    {1, 3, 4, 5, 4, 3, 3, 1, 2, 1, 1, 1},
+    {2, 4, 6, 3, 3, 4, 4, 2, 2, 1, 1, 1},
+    {1, 2, 3, 4, 5, 3, 2, 1, 3, 2, 2, 0},
+    {1, 6, 6, 4, 4, 3, 3, 6, 1, 1, 0, 0},
+  };
+  int errors = 0;
+
+  for (uint i=0; i<sizeof(shapes)/sizeof(conv_shape_t); i++) {
+    const conv_shape_t* s = &shapes[i];
+    uint32_t groups = s->groups ? s->groups : 1;
+    uint32_t ig = s->in_channels / groups, og = s->out_channels / groups;
+    uint32_t oh = transpose_size(s->image_height, s->filter_height, s->stride,
+                                 s->dilation, s->padding_h);
+    uint32_t ow = transpose_size(s->image_width, s->filter_width, s->stride,
+                                 s->dilation, s->padding_w);
+    size_t in_words = (size_t)s->batch_size * s->in_channels *
+                      s->image_height * s->image_width;
+    size_t w_words = (size_t)s->out_channels * ig * s->filter_height *
+                     s->filter_width;
+    size_t out_words = (size_t)s->batch_size * s->out_channels * oh * ow;
+
+    data_t* in_data = allocate_data(in_words);
+    data_t* w_data = allocate_data(w_words);
+    data_t* out_data = calloc(out_words, sizeof(data_t));
+    data_t* expected = calloc(out_words, sizeof(data_t));
+
+    activation_config_t input = make_activations(in_data, s->in_channels,
+                                                 s->image_height,
+                                                 s->image_width);
+    activation_config_t output = make_activations(out_data, s->out_channels,
+                                                  oh, ow);
+    filter_config_t weights = make_weights(w_data, s);
+
+    lat_conv_transpose2d(&input, &weights, &output, s, NULL);
+
+    // Scatter each input value through the whole filter.
+    for (uint b=0; b<s->batch_size; b++)
+      for (uint k=0; k<s->out_channels; k++)
+        for (uint c=0; c<ig; c++)
+          for (uint y=0; y<s->image_height; y++)
+            for (uint x=0; x<s->image_width; x++)
+              for (uint fy=0; fy<s->filter_height; fy++)
+                for (uint fx=0; fx<s->filter_width; fx++) {
+                  int oy = y * s->stride + fy * s->dilation - s->padding_h;
+                  int ox = x * s->stride + fx * s->dilation - s->padding_w;
+                  if (oy < 0 || ox < 0 || oy >= oh || ox >= ow)
+                    continue;
+                  uint ic = (k / og) * ig + c;
+                  expected[((b * s->out_channels + k) * oh + oy) * ow + ox] +=
+                      in_data[((b * s->in_channels + ic) * s->image_height +
+                               y) * s->image_width + x] *
+                      w_data[((k * ig + c) * s->filter_height + fy) *
+                             s->filter_width + fx];
+                }
+
+    errors += compare(out_data, expected, out_words);
+
+    free(in_data);
+    free(w_data);
+    free(out_data);
+    free(expected);
+  }
+
+  report("transposed conv", errors);
+}
+
+static void test_pool(void) {
+  // batch, channels, width, height, window w/h, stride.
+  static const pool_shape_t shapes[] = {
+    {1, 3, 8, 8, 2, 2, 2},
+    {2, 5, 9, 7, 3, 3, 2},
+    {1, 4, 11, 10, 3, 3, 1},
+    {2, 2, 7, 7, 7, 7, 1},
+    {1, 6, 12, 9, 2, 3, 3},
+  };
+  char name[64];
+
+  for (uint cores=1; cores<=4; cores++) {
+    lat_set_cpu_cores(cores);
+
+    for (int average=0; average<2; average++) {
+      int errors = 0;
+
+      for (uint i=0; i<sizeof(shapes)/sizeof(pool_shape_t); i++) {
+        const pool_shape_t* s = &shapes[i];
+        uint32_t oh = (s->input_height - s->window_height) / s->stride + 1;
+        uint32_t ow = (s->input_width - s->window_width) / s->stride + 1;
+        size_t in_words = (size_t)s->batch_size * s->channels *
+                          s->input_height * s->input_width;
+        size_t out_words = (size_t)s->batch_size * s->channels * oh * ow;
+
+        data_t* in_data = allocate_data(in_words);
+        data_t* out_data = allocate_data(out_words);
+        data_t* expected = allocate_data(out_words);
+
+        activation_config_t input = make_activations(in_data, s->channels,
+                                                     s->input_height,
+                                                     s->input_width);
+        activation_config_t output = make_activations(out_data, s->channels,
+                                                      oh, ow);
+
+        if (average)
+          lat_avg_pool_2d(&input, &output, s);
+        else
+          lat_max_pool_2d(&input, &output, s);
+
+        size_t o = 0;
+        for (uint p=0; p<s->batch_size * s->channels; p++)
+          for (uint y=0; y<oh; y++)
+            for (uint x=0; x<ow; x++) {
+              data_t max = in_data[(p * s->input_height + y * s->stride) *
+                                   s->input_width + x * s->stride];
+              data_t sum = 0;
+              for (uint wy=0; wy<s->window_height; wy++)
+                for (uint wx=0; wx<s->window_width; wx++) {
+                  data_t v = in_data[(p * s->input_height + y * s->stride +
+                                      wy) * s->input_width + x * s->stride +
+                                     wx];
+                  sum += v;
+                  if (v > max)
+                    max = v;
+                }
+              expected[o++] = average ?
+                  sum / (data_t)(s->window_height * s->window_width) : max;
+            }
+
+        errors += compare(out_data, expected, out_words);
+
+        free(in_data);
+        free(out_data);
+        free(expected);
+      }
+
+      snprintf(name, sizeof(name), "%s pool, %u cores",
+               average ? "avg" : "max", cores);
+      report(name, errors);
+    }
+  }
+
+  lat_set_cpu_cores(1);
+}
+
+static void test_quantized(void) {
+  const uint32_t n = 2, c = 5, k = 6, h = 9, w = 7;
+  float input_scale = 0.05f, output_scale = 0.1f;
+  float weight_scales[6] = {0.01f, 0.02f, 0.015f, 0.03f, 0.005f, 0.02f};
+  int32_t input_zero = 3, output_zero = -5;
+  int32_t weight_zeros[6] = {1, -2, 0, 3, -1, 2};
+  int errors = 0;
+
+  int8_t* in_data = calloc(n * c * h * w, 1);
+  int8_t* w_data = calloc(k * c * 9, 1);
+  int8_t* out_data = calloc(n * k * h * w, 1);
+  int32_t bias[6];
+  for (uint i=0; i<n*c*h*w; i++)
+    in_data[i] = rand() % 61 - 30;
+  for (uint i=0; i<k*c*9; i++)
+    w_data[i] = rand() % 41 - 20;
+  for (uint i=0; i<k; i++)
+    bias[i] = rand() % 201 - 100;
+
+  memory_location_t location = {0};
+  lat_qtensor_t input, weights, output;
+  location.address = (data_t*)in_data;
+  lat_tensor_init_4d(&input.tensor, location, DTYPE_INT8, n, c, h, w,
+                     LAYOUT_NHWC);
+  location.address = (data_t*)w_data;
+  lat_tensor_init_4d(&weights.tensor, location, DTYPE_INT8, k, c, 3, 3,
+                     LAYOUT_OIHW);
+  location.address = (data_t*)out_data;
+  lat_tensor_init_4d(&output.tensor, location, DTYPE_INT8, n, k, h, w,
+                     LAYOUT_NCHW);
+  input.quant = (lat_quant_params_t){1, &input_scale, &input_zero};
+  weights.quant = (lat_quant_params_t){6, weight_scales, weight_zeros};
+  output.quant = (lat_quant_params_t){1, &output_scale, &output_zero};
+
+  conv_options_t options = {0, 1, 1, 1, 1};
+  lat_quantized_filter_t* filter = lat_quantized_filter_create(&weights);
+  lat_quantized_conv2d(&input, filter, &output, bias, &options, NULL, NULL);
+  lat_quantized_filter_destroy(filter);
+
+  // Requantisation rounds to nearest, so allow for differences in the last
+  // bit between fixed-point and floating-point scales.
+  for (uint b=0; b<n; b++)
+    for (uint o=0; o<k; o++)
+      for (uint y=0; y<h; y++)
+        for (uint x=0; x<w; x++) {
+          int32_t sum = bias[o];
+          for (uint i=0; i<c; i++)
+            for (uint fy=0; fy<3; fy++)
+              for (uint fx=0; fx<3; fx++) {
+                int iy = y + fy - 1, ix = x + fx - 1;
+                if (iy < 0 || ix < 0 || iy >= h || ix >= w)
+                  continue;
+                sum += (in_data[((b * h + iy) * w + ix) * c + i] -
+                        input_zero) *
+                       (w_data[((o * c + i) * 3 + fy) * 3 + fx] -
+                        weight_zeros[o]);
+              }
+
+          double real = sum * (double)input_scale * weight_scales[o] /
+                        output_scale;
+          int32_t q = (int32_t)(real + (real < 0 ? -0.5 : 0.5)) + output_zero;
+          if (q < -128) q = -128;
+          if (q > 127) q = 127;
+
+          int32_t got = out_data[((b * k + o) * h + y) * w + x];
+          if (got - q > 1 || q - got > 1)
+            errors++;
+        }
+
+  report("quantized conv int8", errors);
+
+  // Pool the convolution's output, with a nonzero zero point.
+  for (int average=0; average<2; average++) {
+    const uint32_t ph = (h - 3) / 2 + 1, pw = (w - 3) / 2 + 1;
+    int8_t* pool_data = calloc(n * k * ph * pw, 1);
+    lat_qtensor_t pooled;
+    location.address = (data_t*)pool_data;
+    lat_tensor_init_4d(&pooled.tensor, location, DTYPE_INT8, n, k, ph, pw,
+                       LAYOUT_NCHW);
+    pooled.quant = output.quant;
+
+    if (average)
+      lat_quantized_avg_pool_2d(&output, &pooled, 3, 3, 2);
+    else
+      lat_quantized_max_pool_2d(&output, &pooled, 3, 3, 2);
+
+    errors = 0;
+    for (uint p=0; p<n*k; p++)
+      for (uint y=0; y<ph; y++)
+        for (uint x=0; x<pw; x++) {
+          int32_t max = -1000, sum = 0;
+          for (uint wy=0; wy<3; wy++)
+            for (uint wx=0; wx<3; wx++) {
+              int32_t v = out_data[(p * h + 2 * y + wy) * w + 2 * x + wx] -
+                          output_zero;
+              sum += v;
+              if (v > max)
+                max = v;
+            }
+          int32_t expected = (average ? sum / 9 : max) + output_zero;
+          if (pool_data[(p * ph + y) * pw + x] != expected)
+            errors++;
+        }
+
+    report(average ? "quantized avg pool" : "quantized max pool", errors);
+    free(pool_data);
+  }
+
+  free(in_data);
+  free(w_data);
+  free(out_data);
+}
+
+int main(int argc, char** argv) {
+  srand(1);
+  lat_set_warnings(0);
+
+  test_conv();
+  test_fused();
+  test_sparse();
+  test_winograd();
+  test_transpose();
+  test_pool();
+  test_quantized();
+
+  if (failures)
+    printf("%d tests failed\n", failures);
+  else
+    printf("All tests passed\n");
+
+  return failures ? 1 : 0;
+}